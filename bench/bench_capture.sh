@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# compare the capture rate of canxlrcv with the recvmmsg() socket path
+# and the AF_PACKET TPACKET_V3 ring (-R) for a canxlgen high-rate load
+#
+# canxlrcv -Q reports the received/lost frames per stream and with -R
+# also the kernel ring drops (PACKET_STATISTICS)
+#
+# requires the virtual CAN XL interfaces from create_canxl_vcans.sh
+
+CANXLGEN=../canxlgen
+CANXLRCV=../canxlrcv
+
+IF=${IF:-xlsrc}
+LOOPS=${LOOPS:-200}
+LENGTHS=${LENGTHS:-20:2048}
+BATCH=${BATCH:-64}
+
+for MODE in "socket" "ring -R"; do
+    set -- $MODE
+    echo "== $1"
+
+    $CANXLRCV -Q $2 $IF &
+    RCVPID=$!
+
+    sleep 1
+
+    # unpaced sendmmsg load with sequence numbers
+    $CANXLGEN $IF -Q -b $BATCH -n $LOOPS -l $LENGTHS -p 242
+
+    sleep 1
+
+    # canxlrcv -Q prints its statistics on SIGTERM
+    kill $RCVPID
+    wait $RCVPID
+done
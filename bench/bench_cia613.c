@@ -0,0 +1,414 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * bench_cia613.c - in-process benchmark of the CiA 613-3 frag/join/check
+ *                  paths with JSON output and a regression compare mode
+ *
+ * The paths are measured for PDU lengths 1 .. 2048 and all legal
+ * fragment sizes without any sockets involved:
+ *
+ * frag  : cia613frag (PDUs > fragsz are fragmented, others forwarded)
+ * join  : cia613join (frame type classification and reassembly)
+ * check : cia613check (fragment size rules, reassembly, PDU compare)
+ *
+ * Run 'bench_cia613 -c base.json new.json' to flag regressions between
+ * two results (exit code 1 when a regression has been found).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/can.h>
+#include "libcia613.h"
+
+#define DEFAULT_LEN_STEP 128
+#define DEFAULT_MIN_MS 20 /* min. measurement time per result */
+#define DEFAULT_THRESHOLD 10 /* regression threshold in percent */
+#define MAX_RESULTS 4096
+
+extern int optind, opterr, optopt;
+
+enum {
+	PATH_FRAG,
+	PATH_JOIN,
+	PATH_CHECK,
+	PATH_NUM,
+};
+
+static const char *pathname[PATH_NUM] = { "frag", "join", "check" };
+
+struct result {
+	char path[8];
+	unsigned int fragsz;
+	unsigned int pdulen;
+	unsigned int frags;
+	double ns_per_frag;
+	double pdus_per_s;
+	double bytes_per_s;
+};
+
+static struct canxl_frame src;
+static struct canxl_frame frags[CIA613_MAX_FRAGS];
+static unsigned int nfrags;
+static struct canxl_frame dst[CIA613_MAX_FRAGS];
+static struct canxl_frame pdu;
+static unsigned int fcnt;
+static unsigned int errors;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* create the frames on the wire for the source PDU - see cia613frag */
+static unsigned int run_frag(unsigned int fragsz, struct canxl_frame *out)
+{
+	if (src.len <= fragsz) {
+		memcpy(out, &src, CANXL_HDR_SIZE + src.len);
+		return 1;
+	}
+
+	return frag_pdu(&src, fragsz, &fcnt, out);
+}
+
+/* reassemble the frames on the wire - see cia613join */
+static void run_join(void)
+{
+	struct cia613_rx rx;
+	unsigned int i;
+
+	join_reset(&rx);
+
+	for (i = 0; i < nfrags; i++) {
+		if (cia613_frame_type(&frags[i]) == CIA613_NOFRAG) {
+			memcpy(&pdu, &frags[i], CANXL_HDR_SIZE + frags[i].len);
+			continue;
+		}
+
+		if (join_push(&rx, &pdu, &frags[i]) < 0)
+			errors++;
+	}
+}
+
+/* check the frames on the wire against the source PDU - see cia613check */
+static void run_check(void)
+{
+	struct cia613_rx rx;
+	unsigned int i;
+	int type, ret;
+
+	join_reset(&rx);
+
+	for (i = 0; i < nfrags; i++) {
+		type = cia613_frame_type(&frags[i]);
+
+		switch (type) {
+		case CIA613_NOFRAG:
+			if (frags[i].len != src.len ||
+			    memcmp(frags[i].data, src.data, src.len))
+				errors++;
+			break;
+
+		case CIA613_FF:
+			if (cia613_fragsz_check(type, frags[i].len -
+						LLC_613_3_SIZE) != CIA613_OK)
+				errors++;
+			/* fallthrough */
+		case CIA613_CF:
+		case CIA613_LF:
+			ret = join_push(&rx, &pdu, &frags[i]);
+			if (ret < 0)
+				errors++;
+			else if (ret == CIA613_DONE &&
+				 (pdu.len != src.len ||
+				  memcmp(pdu.data, src.data, src.len)))
+				errors++;
+			break;
+
+		default:
+			errors++;
+			break;
+		}
+	}
+}
+
+static void run(int path, unsigned int fragsz)
+{
+	switch (path) {
+	case PATH_FRAG:
+		run_frag(fragsz, dst);
+		break;
+	case PATH_JOIN:
+		run_join();
+		break;
+	case PATH_CHECK:
+		run_check();
+		break;
+	}
+}
+
+/* run the path until min_ms have elapsed */
+static void measure(int path, unsigned int fragsz, unsigned int min_ms,
+		    struct result *res)
+{
+	unsigned long long iter = 0, n, i;
+	double t0, t = 0;
+
+	/* warm up and estimate the number of iterations */
+	for (n = 16; t < min_ms / 1e3; n *= 2) {
+		t0 = now();
+		for (i = 0; i < n; i++)
+			run(path, fragsz);
+		t += now() - t0;
+		iter += n;
+	}
+
+	strcpy(res->path, pathname[path]);
+	res->fragsz = fragsz;
+	res->pdulen = src.len;
+	res->frags = nfrags;
+	res->ns_per_frag = t * 1e9 / (iter * nfrags);
+	res->pdus_per_s = iter / t;
+	res->bytes_per_s = iter * src.len / t;
+}
+
+static void print_result(FILE *f, struct result *r, int last)
+{
+	fprintf(f, "    {\"path\": \"%s\", \"fragsz\": %u, \"pdulen\": %u, "
+		"\"frags\": %u, \"ns_per_frag\": %.2f, \"pdus_per_s\": %.0f, "
+		"\"bytes_per_s\": %.0f}%s\n", r->path, r->fragsz, r->pdulen,
+		r->frags, r->ns_per_frag, r->pdus_per_s, r->bytes_per_s,
+		last ? "" : ",");
+}
+
+/* read the results in the line based format of print_result() */
+static int read_results(const char *name, struct result *res)
+{
+	FILE *f;
+	char line[256];
+	int n = 0;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) && n < MAX_RESULTS) {
+		if (sscanf(line, " {\"path\": \"%7[a-z]\", \"fragsz\": %u, "
+			   "\"pdulen\": %u, \"frags\": %u, \"ns_per_frag\": %lf, "
+			   "\"pdus_per_s\": %lf, \"bytes_per_s\": %lf}",
+			   res[n].path, &res[n].fragsz, &res[n].pdulen,
+			   &res[n].frags, &res[n].ns_per_frag,
+			   &res[n].pdus_per_s, &res[n].bytes_per_s) == 7)
+			n++;
+	}
+
+	fclose(f);
+
+	if (!n)
+		fprintf(stderr, "%s: no benchmark results found\n", name);
+
+	return n;
+}
+
+static struct result base[MAX_RESULTS], cur[MAX_RESULTS];
+
+static int compare(const char *basefile, const char *curfile,
+		   unsigned int threshold)
+{
+	int nbase, ncur, i, j;
+	unsigned int regressions = 0, improvements = 0, matched = 0;
+	double diff;
+
+	nbase = read_results(basefile, base);
+	ncur = read_results(curfile, cur);
+	if (nbase <= 0 || ncur <= 0)
+		return 2;
+
+	for (i = 0; i < ncur; i++) {
+		for (j = 0; j < nbase; j++) {
+			if (!strcmp(cur[i].path, base[j].path) &&
+			    cur[i].fragsz == base[j].fragsz &&
+			    cur[i].pdulen == base[j].pdulen)
+				break;
+		}
+
+		if (j == nbase)
+			continue;
+
+		matched++;
+		diff = (cur[i].ns_per_frag / base[j].ns_per_frag - 1) * 100;
+
+		if (diff > threshold) {
+			printf("REGRESSION %-5s fragsz %4u pdulen %4u: "
+			       "%.2f -> %.2f ns/frag (%+.1f%%)\n",
+			       cur[i].path, cur[i].fragsz, cur[i].pdulen,
+			       base[j].ns_per_frag, cur[i].ns_per_frag, diff);
+			regressions++;
+		} else if (diff < -(double)threshold)
+			improvements++;
+	}
+
+	printf("compared %u results (threshold %u%%): %u regressions, "
+	       "%u improvements\n", matched, threshold, regressions,
+	       improvements);
+
+	if (!matched)
+		return 2;
+
+	return regressions ? 1 : 0;
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "%s - CiA 613-3 frag/join/check benchmark\n\n", prg);
+	fprintf(stderr, "Usage: %s [options]\n", prg);
+	fprintf(stderr, "       %s [-t <percent>] -c <base.json> <new.json>\n\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -s <step>    (PDU length step - default: %d)\n",
+		DEFAULT_LEN_STEP);
+	fprintf(stderr, "         -f <fragsz>  (only this fragment size)\n");
+	fprintf(stderr, "         -m <ms>      (min. time per result - default: %d)\n",
+		DEFAULT_MIN_MS);
+	fprintf(stderr, "         -o <file>    (JSON output - default: stdout)\n");
+	fprintf(stderr, "         -c           (compare two JSON results)\n");
+	fprintf(stderr, "         -t <percent> (regression threshold - default: %d)\n",
+		DEFAULT_THRESHOLD);
+	fprintf(stderr, "\nThe PDU lengths are 1 and all multiples of <step> up to %d.\n",
+		CANXL_MAX_DLEN);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	unsigned int step = DEFAULT_LEN_STEP;
+	unsigned int min_ms = DEFAULT_MIN_MS;
+	unsigned int threshold = DEFAULT_THRESHOLD;
+	unsigned int onlyfragsz = 0;
+	unsigned int fragsz, len, i;
+	int cmp = 0, path, nres = 0, n = 0;
+	char *outname = NULL;
+	FILE *out = stdout;
+
+	while ((opt = getopt(argc, argv, "s:f:m:o:ct:h?")) != -1) {
+		switch (opt) {
+		case 's':
+			step = strtoul(optarg, NULL, 10);
+			if (step < 1 || step > CANXL_MAX_DLEN) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'f':
+			onlyfragsz = strtoul(optarg, NULL, 10);
+			if (cia613_fragsz_check(CIA613_FF, onlyfragsz) != CIA613_OK) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'm':
+			min_ms = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'o':
+			outname = optarg;
+			break;
+
+		case 'c':
+			cmp = 1;
+			break;
+
+		case 't':
+			threshold = strtoul(optarg, NULL, 10);
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	if (cmp) {
+		if (argc - optind != 2) {
+			print_usage(basename(argv[0]));
+			return 1;
+		}
+		return compare(argv[optind], argv[optind + 1], threshold);
+	}
+
+	if (outname) {
+		out = fopen(outname, "w");
+		if (!out) {
+			perror(outname);
+			return 1;
+		}
+	}
+
+	for (fragsz = MIN_FRAG_SIZE; fragsz <= MAX_FRAG_SIZE;
+	     fragsz += FRAG_STEP_SIZE) {
+		if (onlyfragsz && fragsz != onlyfragsz)
+			continue;
+		for (len = 1; len <= CANXL_MAX_DLEN; len = (len / step + 1) * step)
+			nres += PATH_NUM;
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"bench_cia613\",\n");
+	fprintf(out, "  \"results\": [\n");
+
+	for (fragsz = MIN_FRAG_SIZE; fragsz <= MAX_FRAG_SIZE;
+	     fragsz += FRAG_STEP_SIZE) {
+		if (onlyfragsz && fragsz != onlyfragsz)
+			continue;
+
+		for (len = 1; len <= CANXL_MAX_DLEN;
+		     len = (len / step + 1) * step) {
+			struct result res;
+
+			src.prio = 0x242;
+			src.flags = CANXL_XLF;
+			src.len = len;
+			for (i = 0; i < len; i++)
+				src.data[i] = i;
+
+			/* the frames on the wire for join/check */
+			nfrags = run_frag(fragsz, frags);
+
+			/* verify the paths before measuring them */
+			errors = 0;
+			run_join();
+			if (pdu.len != src.len ||
+			    memcmp(pdu.data, src.data, src.len))
+				errors++;
+			run_check();
+			if (errors) {
+				fprintf(stderr, "fragsz %u pdulen %u: "
+					"reassembly failed\n", fragsz, len);
+				return 1;
+			}
+
+			for (path = 0; path < PATH_NUM; path++) {
+				measure(path, fragsz, min_ms, &res);
+				print_result(out, &res, ++n == nres);
+			}
+		}
+	}
+
+	fprintf(out, "  ]\n}\n");
+
+	if (outname)
+		fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# worst case latency of high priority PDUs (TID 010) under a load of
+# long low priority PDUs (TID 300) for the FIFO and the priority
+# scheduler (option -s) mode of cia613frag
+#
+# the latency is measured from the source frame on xlsrc to the last
+# fragment (LF) on xlfrag with the timestamps of canxlrcv
+#
+# requires the virtual CAN XL interfaces from create_canxl_vcans.sh
+
+CANXLGEN=../canxlgen
+CANXLRCV=../canxlrcv
+CIA613FRAG=../cia613frag
+
+RUNS=${RUNS:-100}
+LOG=/tmp/bench_frag_sched.log
+
+for MODE in "" "-s"; do
+    echo -n "cia613frag ${MODE:-(fifo)}: "
+
+    $CANXLRCV any > $LOG &
+    RCVPID=$!
+
+    $CIA613FRAG xlsrc xlfrag -t 010,300 -f 128 $MODE 2> /dev/null &
+    FRAGPID=$!
+
+    sleep 1
+
+    # low prio background load with 1920 .. 2048 byte PDUs
+    while true; do
+	$CANXLGEN xlsrc -p 300 -l 1920:2048 -g 0
+    done &
+    LOADPID=$!
+
+    # high prio PDUs with 256 bytes (3 fragments)
+    for RUN in $(seq $RUNS); do
+	$CANXLGEN xlsrc -p 010 -l 256:256 -g 0
+	sleep 0.01
+    done
+
+    kill $LOADPID
+    wait $LOADPID 2> /dev/null
+    sleep 1
+    kill $FRAGPID $RCVPID
+    wait $FRAGPID $RCVPID 2> /dev/null
+
+    awk '$3 ~ /^00010#/ {
+	ts = substr($1, 2, length($1) - 2)
+	split($3, f, "#")
+	if ($2 == "xlsrc") {
+	    q[qt++] = ts
+	    next
+	}
+	if ($2 != "xlfrag")
+	    next
+	# fragment (SEC flag) without LF bit in PCI => not completed yet
+	if (substr(f[2], 2, 1) ~ /[13579BDF]/ &&
+	    substr(f[3], 2, 1) !~ /[13579BDF]/)
+	    next
+	lat = (ts - q[qh++]) * 1000000
+	n++
+	sum += lat
+	if (lat > max)
+	    max = lat
+    }
+    END {
+	printf("high prio PDUs %d latency avg %.0f us max %.0f us\n",
+	       n, n ? sum / n : 0, max)
+    }' $LOG
+done
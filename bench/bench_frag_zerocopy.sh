@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# compare the cia613frag CPU time per PDU for the copying write() path
+# and the zero-copy sendmmsg() path (option -z)
+#
+# requires the virtual CAN XL interfaces from create_canxl_vcans.sh
+
+CANXLGEN=../canxlgen
+CIA613FRAG=../cia613frag
+
+RUNS=${RUNS:-20}
+
+for FS in 128 512 1024; do
+    for ZC in "" "-z"; do
+	echo -n "fragsize $FS: "
+
+	$CIA613FRAG xlsrc xlfrag -t 242 -f $FS $ZC &
+	FRAGPID=$!
+
+	sleep 1
+
+	# 1..2048 byte PDUs without gap
+	for RUN in $(seq $RUNS); do
+	    $CANXLGEN xlsrc -p 242 -l 1:2048 -g 0
+	done
+
+	sleep 1
+
+	# cia613frag prints its statistics on SIGTERM
+	kill $FRAGPID
+	wait $FRAGPID
+    done
+done
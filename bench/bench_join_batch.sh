@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# compare the cia613join throughput (rx frames/s) for different
+# recvmmsg/sendmmsg batch sizes
+#
+# requires the virtual CAN XL interfaces from create_canxl_vcans.sh
+# ('batch 1' is the former read()/write() per frame behaviour)
+
+CANXLGEN=../canxlgen
+CIA613FRAG=../cia613frag
+CIA613JOIN=../cia613join
+
+RUNS=${RUNS:-20}
+FRAGSZ=${FRAGSZ:-128}
+
+$CIA613FRAG xlsrc xlfrag -t 242 -f $FRAGSZ &
+FRAGPID=$!
+
+for BATCH in 1 4 16 64; do
+    $CIA613JOIN xlfrag xljoin -t 242 -b $BATCH &
+    JOINPID=$!
+
+    sleep 1
+
+    # 1..2048 byte PDUs without gap
+    for RUN in $(seq $RUNS); do
+	$CANXLGEN xlsrc -p 242 -l 1:2048 -g 0
+    done
+
+    sleep 1
+
+    # cia613join prints its frame statistics on SIGTERM
+    kill $JOINPID
+    wait $JOINPID
+done
+
+kill $FRAGPID
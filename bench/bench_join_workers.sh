@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# compare the cia613join throughput (sum of rx frames/s of all workers)
+# for 1 .. MAXWORKERS worker threads with a TID subset each
+#
+# requires the virtual CAN XL interfaces from create_canxl_vcans.sh
+
+CANXLGEN=../canxlgen
+CIA613FRAG=../cia613frag
+CIA613JOIN=../cia613join
+
+RUNS=${RUNS:-20}
+FRAGSZ=${FRAGSZ:-128}
+MAXWORKERS=${MAXWORKERS:-$(nproc)}
+TIDS=${TIDS:-"200,210,220,230,240,250,260,270"}
+
+$CIA613FRAG xlsrc xlfrag -t $TIDS -f $FRAGSZ &
+FRAGPID=$!
+
+for WORKERS in $(seq $MAXWORKERS); do
+    $CIA613JOIN xlfrag xljoin -t $TIDS -b 16 -w $WORKERS 2> join.stats &
+    JOINPID=$!
+
+    sleep 1
+
+    # one generator per TID - 1..2048 byte PDUs without gap
+    GENPIDS=
+    for TID in ${TIDS//,/ }; do
+	for RUN in $(seq $RUNS); do
+	    $CANXLGEN xlsrc -p $TID -l 1:2048 -g 0
+	done &
+	GENPIDS="$GENPIDS $!"
+    done
+    wait $GENPIDS
+
+    sleep 1
+
+    # cia613join prints the frame statistics of each worker on SIGTERM
+    kill $JOINPID
+    wait $JOINPID
+
+    awk -v w=$WORKERS '/rx frames\/s/ { gsub(/\(/, "", $0);
+	for (i = 1; i < NF; i++) if ($(i + 1) == "rx" && $(i + 2) == "frames/s)") sum += $i }
+	END { printf("workers %d: %.0f rx frames/s\n", w, sum) }' join.stats
+done
+
+rm -f join.stats
+kill $FRAGPID
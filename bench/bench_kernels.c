@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * bench_kernels.c - compare the fragment size specific libcia613 kernels
+ *                   with the generic fragmentation/reassembly path
+ *
+ * For each legal fragment size the output of both paths is checked to be
+ * identical before the time per PDU is measured.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/can.h>
+#include "libcia613.h"
+
+#define DEFAULT_ROUNDS 200000
+#define NPDUS 16 /* different source frames per round */
+
+extern int optind, opterr, optopt;
+
+static struct canxl_frame src[NPDUS];
+static struct canxl_frame frags[NPDUS][CIA613_MAX_FRAGS];
+static unsigned int nfrags[NPDUS];
+static struct canxl_frame dst[CIA613_MAX_FRAGS];
+static struct canxl_frame pdu;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int frag_generic(const struct canxl_frame *cf,
+				 unsigned int fragsz, unsigned int *fcnt,
+				 struct canxl_frame *out)
+{
+	struct cia613_frag f;
+	unsigned int n = 0;
+
+	frag_init(&f, cf, fragsz, fcnt);
+	while (frag_next(&f, &out[n]))
+		n++;
+
+	return n;
+}
+
+/* returns 1 when the reassembled PDU is not equal to the source frame */
+static int join_all(int generic, unsigned int i)
+{
+	struct cia613_rx rx;
+	unsigned int j;
+	int ret = CIA613_OK;
+
+	join_reset(&rx);
+
+	for (j = 0; j < nfrags[i]; j++) {
+		if (generic)
+			ret = join_push_generic(&rx, &pdu, &frags[i][j]);
+		else
+			ret = join_push(&rx, &pdu, &frags[i][j]);
+	}
+
+	if (ret != CIA613_DONE || pdu.len != src[i].len ||
+	    memcmp(pdu.data, src[i].data, pdu.len))
+		return 1;
+
+	return 0;
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "%s - libcia613 fragment size kernel benchmark\n\n", prg);
+	fprintf(stderr, "Usage: %s [options]\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -n <rounds>  (default: %d)\n", DEFAULT_ROUNDS);
+	fprintf(stderr, "         -l <pdulen>  (fixed PDU length - default: "
+		"%d to %d)\n", MAX_FRAG_SIZE + 1, CANXL_MAX_DLEN);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	unsigned int rounds = DEFAULT_ROUNDS;
+	unsigned int pdulen = 0;
+	unsigned int fragsz, fcnt, fcnt2, n, r, i, j, total;
+	double t0, tgen, tker, jgen, jker;
+
+	while ((opt = getopt(argc, argv, "n:l:h?")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'l':
+			pdulen = strtoul(optarg, NULL, 10);
+			if (pdulen < 1 || pdulen > CANXL_MAX_DLEN) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	/* source frames which are fragmented with all fragment sizes */
+	for (i = 0; i < NPDUS; i++) {
+		src[i].prio = 0x242;
+		src[i].flags = CANXL_XLF;
+		src[i].len = pdulen ? pdulen : MAX_FRAG_SIZE + 1 +
+			(i * 61) % (CANXL_MAX_DLEN - MAX_FRAG_SIZE);
+		for (j = 0; j < src[i].len; j++)
+			src[i].data[j] = i + j;
+	}
+
+	printf("fragsz  frag generic  frag kernel  speedup  "
+	       "join generic  join kernel  speedup  (ns/PDU)\n");
+
+	for (fragsz = MIN_FRAG_SIZE; fragsz <= MAX_FRAG_SIZE;
+	     fragsz += FRAG_STEP_SIZE) {
+
+		/* both paths have to create identical fragments */
+		fcnt = fcnt2 = 0;
+		for (i = 0, total = 0; i < NPDUS; i++) {
+			nfrags[i] = frag_pdu(&src[i], fragsz, &fcnt, frags[i]);
+			n = frag_generic(&src[i], fragsz, &fcnt2, dst);
+			if (n != nfrags[i]) {
+				fprintf(stderr, "fragsz %u: fragment count mismatch\n",
+					fragsz);
+				return 1;
+			}
+			for (j = 0; j < n; j++) {
+				if (memcmp(&dst[j], &frags[i][j],
+					   CANXL_HDR_SIZE + dst[j].len)) {
+					fprintf(stderr, "fragsz %u: fragment mismatch\n",
+						fragsz);
+					return 1;
+				}
+			}
+			total += n;
+
+			if (join_all(0, i) || join_all(1, i)) {
+				fprintf(stderr, "fragsz %u: reassembly mismatch\n",
+					fragsz);
+				return 1;
+			}
+		}
+
+		t0 = now();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < NPDUS; i++)
+				frag_generic(&src[i], fragsz, &fcnt, dst);
+		tgen = now() - t0;
+
+		t0 = now();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < NPDUS; i++)
+				frag_pdu(&src[i], fragsz, &fcnt, dst);
+		tker = now() - t0;
+
+		t0 = now();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < NPDUS; i++)
+				join_all(1, i);
+		jgen = now() - t0;
+
+		t0 = now();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < NPDUS; i++)
+				join_all(0, i);
+		jker = now() - t0;
+
+		n = rounds * NPDUS;
+		printf("%6u  %12.1f  %11.1f  %6.2fx  %12.1f  %11.1f  %6.2fx  "
+		       "(%.1f frags/PDU)\n", fragsz,
+		       tgen * 1e9 / n, tker * 1e9 / n, tgen / tker,
+		       jgen * 1e9 / n, jker * 1e9 / n, jgen / jker,
+		       (double)total / NPDUS);
+	}
+
+	return 0;
+}
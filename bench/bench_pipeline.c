@@ -0,0 +1,378 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * bench_pipeline.c - end-to-end latency and loss of the PoC gateway chain
+ *
+ * Sends PDUs with a sequence number at a fixed rate to the source
+ * interface (xlsrc) and receives the joined PDUs on the destination
+ * interface (xljoin). Both sides are timestamped by the kernel
+ * (SO_TIMESTAMPNS) on the CAN interfaces, so the latency covers the
+ * complete path through cia613frag and cia613join.
+ *
+ * The PDU data starts with the 32 bit sequence number (network byte
+ * order) followed by a length depended pattern.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#define DEFAULT_PRIO_ID 0x242
+#define DEFAULT_RATE 1000 /* PDUs/s */
+#define DEFAULT_DURATION 5 /* seconds */
+#define DEFAULT_DRAIN 500 /* ms to wait for outstanding PDUs */
+#define DEFAULT_FROM 4
+#define DEFAULT_TO 2048
+#define SEQ_SIZE 4
+
+extern int optind, opterr, optopt;
+
+static struct timespec *tsrc; /* rx timestamp on the source interface */
+static struct timespec *tdst; /* rx timestamp on the destination interface */
+static unsigned int npdus;
+static unsigned int received, duplicates, corrupted;
+static unsigned long long rxbytes;
+static canid_t prio = DEFAULT_PRIO_ID;
+
+static double ts_us(const struct timespec *ts)
+{
+	return ts->tv_sec * 1e6 + ts->tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int open_socket(const char *ifname)
+{
+	struct sockaddr_can addr;
+	struct can_filter rfilter;
+	int sockopt = 1;
+	int s;
+
+	if (strlen(ifname) >= IFNAMSIZ) {
+		printf("Name of CAN device '%s' is too long!\n\n", ifname);
+		return -1;
+	}
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+		       &sockopt, sizeof(sockopt)) < 0) {
+		perror("sockopt CAN_RAW_XL_FRAMES");
+		return -1;
+	}
+
+	if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS,
+		       &sockopt, sizeof(sockopt)) < 0) {
+		perror("sockopt SO_TIMESTAMPNS");
+		return -1;
+	}
+
+	/* only the PDUs of this benchmark */
+	rfilter.can_id = prio;
+	rfilter.can_mask = CANXL_PRIO_MASK;
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER,
+		       &rfilter, sizeof(rfilter)) < 0) {
+		perror("sockopt CAN_RAW_FILTER");
+		return -1;
+	}
+
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(ifname);
+	if (!addr.can_ifindex) {
+		perror(ifname);
+		return -1;
+	}
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return -1;
+	}
+
+	return s;
+}
+
+/*
+ * receive one PDU and store its timestamp in tab[seq]
+ *
+ * returns the number of bytes read or -1 when no PDU is pending
+ */
+static int rx_pdu(int s, struct timespec *tab, int isdst)
+{
+	struct canxl_frame cf;
+	char ctrlmsg[CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec iov = { .iov_base = &cf, .iov_len = sizeof(cf) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctrlmsg,
+		.msg_controllen = sizeof(ctrlmsg),
+	};
+	struct cmsghdr *cmsg;
+	struct timespec ts = { 0 };
+	unsigned int seq, i;
+	int nbytes;
+
+	nbytes = recvmsg(s, &msg, MSG_DONTWAIT);
+	if (nbytes < 0)
+		return -1;
+
+	if (nbytes < (int)CANXL_HDR_SIZE + SEQ_SIZE ||
+	    !(cf.flags & CANXL_XLF) || cf.len < SEQ_SIZE)
+		return nbytes;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SO_TIMESTAMPNS)
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+	}
+
+	seq = ntohl(*(__u32 *)cf.data);
+	if (seq >= npdus)
+		return nbytes;
+
+	if (isdst) {
+		/* joined PDU has to be identical to the source PDU */
+		for (i = SEQ_SIZE; i < cf.len; i++) {
+			if (cf.data[i] != ((cf.len + i) & 0xFFU)) {
+				corrupted++;
+				return nbytes;
+			}
+		}
+
+		if (tab[seq].tv_sec) {
+			duplicates++;
+			return nbytes;
+		}
+		received++;
+		rxbytes += cf.len;
+	}
+
+	tab[seq] = ts;
+
+	return nbytes;
+}
+
+/* returns 1 when a is not later than b */
+static int ts_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec);
+}
+
+static void ts_add_ns(struct timespec *ts, long long ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000LL;
+	ts->tv_nsec = ns % 1000000000LL;
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "%s - CiA 613-3 gateway chain latency benchmark\n\n", prg);
+	fprintf(stderr, "Usage: %s [options] <src_if> <dst_if>\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -r <rate>      (PDUs per second "
+		"- default: %d)\n", DEFAULT_RATE);
+	fprintf(stderr, "         -d <seconds>   (duration "
+		"- default: %d s)\n", DEFAULT_DURATION);
+	fprintf(stderr, "         -l <from>:<to> (length of the PDUs "
+		"- default: %d to %d)\n", DEFAULT_FROM, DEFAULT_TO);
+	fprintf(stderr, "         -p <prio_id>   (PRIO ID "
+		"- default: 0x%03X)\n", DEFAULT_PRIO_ID);
+	fprintf(stderr, "         -w <ms>        (wait for outstanding PDUs "
+		"- default: %d ms)\n", DEFAULT_DRAIN);
+	fprintf(stderr, "         -f <fragsz>    (fragment size label "
+		"for the result)\n");
+	fprintf(stderr, "\nExample: %s -r 5000 -f 128 xlsrc xljoin\n", prg);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	unsigned int rate = DEFAULT_RATE;
+	unsigned int duration = DEFAULT_DURATION;
+	unsigned int drain = DEFAULT_DRAIN;
+	unsigned int from = DEFAULT_FROM;
+	unsigned int to = DEFAULT_TO;
+	unsigned int fragsz = 0;
+	unsigned int seq, i, n, dlen;
+	struct canxl_frame cfx = { 0 };
+	struct timespec next, now, t0, end = { 0 };
+	struct pollfd pfd[2];
+	double *lat, elapsed;
+	long long interval;
+	int tx, timeout;
+
+	while ((opt = getopt(argc, argv, "r:d:l:p:w:f:h?")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'd':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'l':
+			if (sscanf(optarg, "%u:%u", &from, &to) != 2 ||
+			    from < SEQ_SIZE || to > CANXL_MAX_DLEN || from > to) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'p':
+			prio = strtoul(optarg, NULL, 16);
+			if (prio & ~CANXL_PRIO_MASK) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'w':
+			drain = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'f':
+			fragsz = strtoul(optarg, NULL, 10);
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	if (argc - optind != 2 || !rate || !duration) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
+	npdus = rate * duration;
+	tsrc = calloc(npdus, sizeof(*tsrc));
+	tdst = calloc(npdus, sizeof(*tdst));
+	lat = calloc(npdus, sizeof(*lat));
+	if (!tsrc || !tdst || !lat) {
+		perror("calloc");
+		return 1;
+	}
+
+	/* tx socket and the timestamping rx sockets on src_if and dst_if */
+	tx = open_socket(argv[optind]);
+	pfd[0].fd = open_socket(argv[optind]);
+	pfd[1].fd = open_socket(argv[optind + 1]);
+	if (tx < 0 || pfd[0].fd < 0 || pfd[1].fd < 0)
+		return 1;
+	pfd[0].events = pfd[1].events = POLLIN;
+
+	cfx.prio = prio;
+	cfx.flags = CANXL_XLF;
+
+	interval = 1000000000LL / rate;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	next = t0;
+	seq = 0;
+	dlen = from;
+
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (seq < npdus && ts_before(&next, &now)) {
+			cfx.len = dlen;
+			*(__u32 *)cfx.data = htonl(seq);
+			for (i = SEQ_SIZE; i < dlen; i++)
+				cfx.data[i] = (dlen + i) & 0xFFU;
+
+			if (write(tx, &cfx, CANXL_HDR_SIZE + dlen) !=
+			    CANXL_HDR_SIZE + dlen) {
+				perror("write");
+				return 1;
+			}
+
+			if (++dlen > to)
+				dlen = from;
+
+			if (++seq == npdus) {
+				end = now;
+				ts_add_ns(&end, drain * 1000000LL);
+			}
+			ts_add_ns(&next, interval);
+		}
+
+		/* always drain the rx sockets to not lose PDUs under load */
+		while (rx_pdu(pfd[0].fd, tsrc, 0) >= 0)
+			;
+		while (rx_pdu(pfd[1].fd, tdst, 1) >= 0)
+			;
+
+		if (seq == npdus) {
+			if (received == npdus || ts_before(&end, &now))
+				break;
+			timeout = 1;
+		} else if (ts_before(&next, &now)) {
+			/* next PDU is already due */
+			continue;
+		} else {
+			/* sleep until the next PDU is due */
+			timeout = ((next.tv_sec - now.tv_sec) * 1000000000LL +
+				   next.tv_nsec - now.tv_nsec) / 1000000;
+		}
+
+		if (poll(pfd, 2, timeout) < 0) {
+			perror("poll");
+			return 1;
+		}
+	}
+
+	/* sending time of all PDUs */
+	elapsed = (end.tv_sec - t0.tv_sec) + (end.tv_nsec - t0.tv_nsec) / 1e9 -
+		drain / 1e3;
+
+	for (seq = 0, n = 0; seq < npdus; seq++) {
+		if (tsrc[seq].tv_sec && tdst[seq].tv_sec)
+			lat[n++] = ts_us(&tdst[seq]) - ts_us(&tsrc[seq]);
+	}
+
+	qsort(lat, n, sizeof(*lat), cmp_double);
+
+	printf("fragsz %u rate %u PDUs/s: sent %u received %u lost %u "
+	       "(%.3f%%) duplicates %u corrupted %u\n", fragsz, rate, npdus,
+	       received, npdus - received,
+	       (npdus - received) * 100.0 / npdus, duplicates, corrupted);
+	printf("fragsz %u throughput tx %.0f PDUs/s rx %.0f PDUs/s "
+	       "%.0f bytes/s\n", fragsz, npdus / elapsed, received / elapsed,
+	       rxbytes / elapsed);
+
+	if (n)
+		printf("fragsz %u latency p50 %.1f p99 %.1f p99.9 %.1f "
+		       "max %.1f us\n", fragsz, lat[n / 2], lat[n * 99 / 100],
+		       lat[n * 999 / 1000], lat[n - 1]);
+	else
+		printf("fragsz %u latency no joined PDUs\n", fragsz);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# end-to-end throughput, latency (p50/p99/p99.9) and loss of the PoC
+# data flow xlsrc -> cia613frag -> xlfrag -> cia613join -> xljoin for
+# all fragment sizes under a sustained PDU rate
+#
+# the virtual CAN XL interfaces are created with create_canxl_vcans.sh
+# when they do not exist (requires root)
+
+BENCHPIPELINE=./bench_pipeline
+CIA613FRAG=../cia613frag
+CIA613JOIN=../cia613join
+
+RATE=${RATE:-5000}
+DURATION=${DURATION:-10}
+LENGTHS=${LENGTHS:-4:2048}
+FRAGSIZES=${FRAGSIZES:-"128 256 384 512 640 768 896 1024"}
+
+for IF in xlsrc xlfrag xljoin; do
+    if ! ip link show $IF > /dev/null 2>&1; then
+	../create_canxl_vcans.sh start || exit 1
+	break
+    fi
+done
+
+for FRAGSZ in $FRAGSIZES; do
+    $CIA613FRAG xlsrc xlfrag -t 242 -f $FRAGSZ &
+    FRAGPID=$!
+    $CIA613JOIN xlfrag xljoin -t 242 2> /dev/null &
+    JOINPID=$!
+
+    sleep 1
+
+    $BENCHPIPELINE -r $RATE -d $DURATION -l $LENGTHS -p 242 -f $FRAGSZ \
+	xlsrc xljoin
+
+    kill $FRAGPID $JOINPID
+    wait $FRAGPID $JOINPID 2> /dev/null
+done
@@ -0,0 +1,489 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * canlog.h - SocketCAN (candump) text log file reader/writer
+ *
+ * The log file is mapped into memory and parsed line by line without
+ * copying the lines. Lines which do not start with a '(' timestamp are
+ * comments (e.g. in the test/ testcases) and are skipped.
+ *
+ * (1715846400.123456) xlsrc 00242#81:00:AF1234AF#25000001AABBCC
+ * (1715846400.123456) can0 123#1122334455667788
+ * (1715846400.123456) can0 12345678##1112233
+ *
+ * CAN XL frames: <vcid><prio>#<flags>:<sdt>:<af>#<data> (vcid optional)
+ *
+ * Binary captures (xlcap.h) are detected by their file header and read
+ * with the same API, so all log readers also accept binary captures.
+ *
+ */
+
+#ifndef CANLOG_H
+#define CANLOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "xlcap.h"
+
+/* max. length of a frame in ASCII representation (CAN XL with 2048 bytes) */
+#define CANLOG_FRAME_STRLEN (5 + 1 + 2 + 1 + 2 + 1 + 8 + 1 + 2 * CANXL_MAX_DLEN)
+
+struct canlog {
+	char *buf; /* mapped log file */
+	size_t size;
+	size_t pos; /* start of the next line */
+	unsigned int line; /* line number of the last parsed line */
+	struct xlcap *cap; /* binary capture (record number in line) */
+};
+
+/* log line content */
+struct canlog_frame {
+	struct timeval tv;
+	char ifname[IFNAMSIZ];
+	unsigned int mtu; /* CAN_MTU, CANFD_MTU or CANXL_MTU */
+	union {
+		struct can_frame cc;
+		struct canfd_frame fd;
+		struct canxl_frame xl;
+	};
+};
+
+/* returns 0 on success or -1 with errno set */
+static inline int canlog_open(struct canlog *log, const char *name)
+{
+	struct stat st;
+	int fd;
+
+	memset(log, 0, sizeof(*log));
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	log->size = st.st_size;
+	if (log->size) {
+		log->buf = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (log->buf == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise(log->buf, log->size, MADV_SEQUENTIAL);
+	}
+
+	close(fd);
+
+	if (xlcap_detect(log->buf, log->size)) {
+		log->cap = malloc(sizeof(*log->cap));
+		if (!log->cap || xlcap_attach(log->cap, log->buf, log->size)) {
+			free(log->cap);
+			log->cap = NULL;
+			munmap(log->buf, log->size);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static inline void canlog_close(struct canlog *log)
+{
+	if (log->cap) {
+		/* the mapping is owned by the canlog */
+		free(log->cap->zbuf);
+		free(log->cap);
+		log->cap = NULL;
+	}
+
+	if (log->size)
+		munmap(log->buf, log->size);
+	log->buf = NULL;
+	log->size = 0;
+}
+
+/* restart at the beginning of the log */
+static inline void canlog_rewind(struct canlog *log)
+{
+	log->pos = 0;
+	log->line = 0;
+
+	if (log->cap)
+		xlcap_rewind(log->cap);
+}
+
+static inline int canlog_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/* parse hex digits until a non hex character - returns the digit count */
+static inline int canlog_hex(const char **p, const char *end,
+			     unsigned long *val)
+{
+	const char *s = *p;
+	int n;
+
+	*val = 0;
+	while (s < end && (n = canlog_nibble(*s)) >= 0) {
+		*val = (*val << 4) | n;
+		s++;
+	}
+
+	n = s - *p;
+	*p = s;
+
+	return n;
+}
+
+/* parse decimal digits - returns the digit count */
+static inline int canlog_dec(const char **p, const char *end,
+			     unsigned long *val)
+{
+	const char *s = *p;
+	int n;
+
+	*val = 0;
+	while (s < end && *s >= '0' && *s <= '9')
+		*val = *val * 10 + (*s++ - '0');
+
+	n = s - *p;
+	*p = s;
+
+	return n;
+}
+
+/* parse hex data bytes - returns the number of bytes or -1 */
+static inline int canlog_data(const char **p, const char *end, __u8 *data,
+			      unsigned int max)
+{
+	const char *s = *p;
+	unsigned int len = 0;
+	int hi, lo;
+
+	while (s < end && *s != ' ' && *s != '\t' && *s != '\r' &&
+	       *s != '_') {
+		/* optional byte separator */
+		if (*s == '.') {
+			s++;
+			continue;
+		}
+
+		if (s + 1 >= end || len >= max)
+			return -1;
+
+		hi = canlog_nibble(s[0]);
+		lo = canlog_nibble(s[1]);
+		if (hi < 0 || lo < 0)
+			return -1;
+
+		data[len++] = (hi << 4) | lo;
+		s += 2;
+	}
+
+	*p = s;
+
+	return len;
+}
+
+/* parse the frame in ASCII representation - returns the MTU or 0 */
+static inline unsigned int canlog_parse_frame(const char *s, const char *end,
+					      struct canlog_frame *lf)
+{
+	unsigned long id, val;
+	int n, len;
+
+	n = canlog_hex(&s, end, &id);
+	if (!n || s >= end || *s++ != '#')
+		return 0;
+
+	/* CAN XL: <vcid><prio>#<flags>:<sdt>:<af>#<data> */
+	if (end - s > 3 && s[2] == ':') {
+		struct canxl_frame *cfx = &lf->xl;
+
+		memset(cfx, 0, CANXL_HDR_SIZE);
+		cfx->prio = id & CANXL_PRIO_MASK;
+		if (n > 3)
+			cfx->prio |= ((id >> 12) << CANXL_VCID_OFFSET) &
+				CANXL_VCID_MASK;
+
+		if (canlog_hex(&s, end, &val) != 2 || s >= end || *s++ != ':')
+			return 0;
+		cfx->flags = val;
+
+		if (canlog_hex(&s, end, &val) != 2 || s >= end || *s++ != ':')
+			return 0;
+		cfx->sdt = val;
+
+		if (canlog_hex(&s, end, &val) != 8 || s >= end || *s++ != '#')
+			return 0;
+		cfx->af = val;
+
+		len = canlog_data(&s, end, cfx->data, CANXL_MAX_DLEN);
+		if (len < CANXL_MIN_DLEN)
+			return 0;
+		cfx->len = len;
+
+		return CANXL_MTU;
+	}
+
+	/* CAN FD: <id>##<flags><data> */
+	if (s < end && *s == '#') {
+		struct canfd_frame *cfd = &lf->fd;
+
+		memset(cfd, 0, sizeof(*cfd));
+		cfd->can_id = (n == 8) ? id | CAN_EFF_FLAG : id;
+
+		s++;
+		if (s >= end || (n = canlog_nibble(*s)) < 0)
+			return 0;
+		cfd->flags = n;
+		s++;
+
+		len = canlog_data(&s, end, cfd->data, CANFD_MAX_DLEN);
+		if (len < 0)
+			return 0;
+		cfd->len = len;
+
+		return CANFD_MTU;
+	}
+
+	/* Classical CAN: <id>#<data>[_<len8_dlc>] or <id>#R[<len>] */
+	{
+		struct can_frame *cf = &lf->cc;
+
+		memset(cf, 0, sizeof(*cf));
+		cf->can_id = (n == 8) ? id | CAN_EFF_FLAG : id;
+
+		if (s < end && *s == 'R') {
+			cf->can_id |= CAN_RTR_FLAG;
+			s++;
+			if (s < end && (n = canlog_nibble(*s)) >= 0 &&
+			    n <= CAN_MAX_DLEN)
+				cf->len = n;
+			return CAN_MTU;
+		}
+
+		len = canlog_data(&s, end, cf->data, CAN_MAX_DLEN);
+		if (len < 0)
+			return 0;
+		cf->len = len;
+
+		if (s + 1 < end && *s == '_' && len == CAN_MAX_DLEN) {
+			n = canlog_nibble(s[1]);
+			if (n > CAN_MAX_DLEN && n <= CAN_MAX_RAW_DLC)
+				cf->len8_dlc = n;
+		}
+
+		return CAN_MTU;
+	}
+}
+
+/* copy the next binary capture record into lf */
+static inline int canlog_read_cap(struct canlog *log, struct canlog_frame *lf)
+{
+	const struct xlcap_rec *r = xlcap_next(log->cap);
+
+	if (!r)
+		return log->cap->err ? -1 : 0;
+
+	log->line++;
+	lf->tv.tv_sec = r->sec;
+	lf->tv.tv_usec = r->nsec / 1000;
+	strcpy(lf->ifname, xlcap_ifname(log->cap, r));
+	lf->mtu = xlcap_type2mtu(r->type);
+
+	if (lf->mtu != CANXL_MTU)
+		memset(&lf->fd, 0, sizeof(lf->fd));
+	memcpy(&lf->xl, r->frame, r->len);
+
+	return lf->mtu;
+}
+
+/*
+ * read the next frame from the log
+ *
+ * returns the MTU of the frame, 0 at the end of the log or -1 for a
+ * malformed line (log->line)
+ */
+static inline int canlog_read(struct canlog *log, struct canlog_frame *lf)
+{
+	const char *s, *end, *tok;
+	unsigned long val;
+	unsigned int mtu;
+	size_t n;
+	char *nl;
+
+	if (log->cap)
+		return canlog_read_cap(log, lf);
+
+	while (log->pos < log->size) {
+		s = log->buf + log->pos;
+		nl = memchr(s, '\n', log->size - log->pos);
+		end = nl ? nl : log->buf + log->size;
+		log->pos = end - log->buf + 1;
+		log->line++;
+
+		/* comment or empty line */
+		if (*s != '(')
+			continue;
+
+		/* (<sec>.<usec>) */
+		s++;
+		if (!canlog_dec(&s, end, &val) || s >= end || *s++ != '.')
+			return -1;
+		lf->tv.tv_sec = val;
+
+		tok = s;
+		if (!canlog_dec(&s, end, &val) || s >= end || *s++ != ')')
+			return -1;
+		/* scale fraction to usecs */
+		for (n = s - tok - 1; n < 6; n++)
+			val *= 10;
+		for (; n > 6; n--)
+			val /= 10;
+		lf->tv.tv_usec = val;
+
+		/* interface name */
+		while (s < end && *s == ' ')
+			s++;
+		tok = s;
+		while (s < end && *s != ' ')
+			s++;
+		n = s - tok;
+		if (!n || n >= IFNAMSIZ)
+			return -1;
+		memcpy(lf->ifname, tok, n);
+		lf->ifname[n] = 0;
+
+		while (s < end && *s == ' ')
+			s++;
+
+		mtu = canlog_parse_frame(s, end, lf);
+		if (!mtu)
+			return -1;
+
+		lf->mtu = mtu;
+
+		return mtu;
+	}
+
+	return 0;
+}
+
+static const char canlog_hexdigit[] = "0123456789ABCDEF";
+
+static inline char *canlog_put_hex(char *s, unsigned long val, int digits)
+{
+	while (digits--)
+		*s++ = canlog_hexdigit[(val >> (digits * 4)) & 0xF];
+
+	return s;
+}
+
+static inline char *canlog_put_data(char *s, const __u8 *data,
+				    unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		*s++ = canlog_hexdigit[data[i] >> 4];
+		*s++ = canlog_hexdigit[data[i] & 0xF];
+	}
+
+	return s;
+}
+
+/*
+ * print the frame in ASCII representation into buf (CANLOG_FRAME_STRLEN + 1)
+ *
+ * returns the string length
+ */
+static inline int canlog_sprint_frame(char *buf, const void *frame,
+				      unsigned int mtu)
+{
+	char *s = buf;
+
+	if (mtu == CANXL_MTU) {
+		const struct canxl_frame *cfx = frame;
+
+		s = canlog_put_hex(s, (cfx->prio & CANXL_VCID_MASK) >>
+				   CANXL_VCID_OFFSET, 2);
+		s = canlog_put_hex(s, cfx->prio & CANXL_PRIO_MASK, 3);
+		*s++ = '#';
+		s = canlog_put_hex(s, cfx->flags, 2);
+		*s++ = ':';
+		s = canlog_put_hex(s, cfx->sdt, 2);
+		*s++ = ':';
+		s = canlog_put_hex(s, cfx->af, 8);
+		*s++ = '#';
+		s = canlog_put_data(s, cfx->data, cfx->len);
+	} else {
+		const struct canfd_frame *cfd = frame;
+
+		if (cfd->can_id & CAN_EFF_FLAG)
+			s = canlog_put_hex(s, cfd->can_id & CAN_EFF_MASK, 8);
+		else
+			s = canlog_put_hex(s, cfd->can_id & CAN_SFF_MASK, 3);
+		*s++ = '#';
+
+		if (mtu == CANFD_MTU) {
+			*s++ = '#';
+			*s++ = canlog_hexdigit[cfd->flags & 0xF];
+			s = canlog_put_data(s, cfd->data, cfd->len);
+		} else {
+			const struct can_frame *cf = frame;
+
+			if (cf->can_id & CAN_RTR_FLAG) {
+				*s++ = 'R';
+				if (cf->len)
+					*s++ = canlog_hexdigit[cf->len & 0xF];
+			} else {
+				s = canlog_put_data(s, cf->data, cf->len);
+				if (cf->len == CAN_MAX_DLEN &&
+				    cf->len8_dlc > CAN_MAX_DLEN &&
+				    cf->len8_dlc <= CAN_MAX_RAW_DLC) {
+					*s++ = '_';
+					*s++ = canlog_hexdigit[cf->len8_dlc];
+				}
+			}
+		}
+	}
+
+	*s = 0;
+
+	return s - buf;
+}
+
+/* print a complete log line with timestamp and interface name */
+static inline void canlog_fprint(FILE *f, const struct timeval *tv,
+				 const char *ifname, const void *frame,
+				 unsigned int mtu)
+{
+	char buf[CANLOG_FRAME_STRLEN + 1];
+
+	canlog_sprint_frame(buf, frame, mtu);
+	fprintf(f, "(%ld.%06ld) %s %s\n", tv->tv_sec, tv->tv_usec, ifname,
+		buf);
+}
+
+#endif /* CANLOG_H */
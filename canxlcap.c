@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * canxlcap.c - convert between candump logs and binary captures
+ *
+ * Both input formats are read with canlog.h. Binary captures (xlcap.h)
+ * are iterated in place with xlcap_next() to keep the nanosecond
+ * timestamps and to avoid copying the frames.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <net/if.h>
+
+#include <linux/can.h>
+
+#include "canlog.h"
+#include "xlcap.h"
+
+#define OUTBUF_SIZE (1 << 20)
+
+extern int optind, opterr, optopt;
+
+/* statistics for -i */
+static unsigned long long frames[3];
+static struct timespec first, last;
+static char ifnames[XLCAP_MAX_IFS][IFNAMSIZ];
+static unsigned int nifnames;
+
+static void print_line(FILE *f, const struct timespec *ts, const char *ifname,
+		       const void *frame, unsigned int mtu)
+{
+	char buf[64 + IFNAMSIZ + CANLOG_FRAME_STRLEN];
+	int n;
+
+	n = sprintf(buf, "(%ld.%06ld) %s ", ts->tv_sec, ts->tv_nsec / 1000,
+		    ifname);
+	n += canlog_sprint_frame(&buf[n], frame, mtu);
+	buf[n++] = '\n';
+	fwrite(buf, 1, n, f);
+}
+
+static void account(const struct timespec *ts, const char *ifname,
+		    unsigned int mtu)
+{
+	unsigned int i;
+
+	frames[(mtu == CANXL_MTU) ? XLCAP_XL :
+	       (mtu == CANFD_MTU) ? XLCAP_FD : XLCAP_CC]++;
+
+	if (!first.tv_sec && !first.tv_nsec)
+		first = *ts;
+	last = *ts;
+
+	for (i = 0; i < nifnames; i++)
+		if (!strcmp(ifnames[i], ifname))
+			return;
+
+	if (nifnames < XLCAP_MAX_IFS)
+		strcpy(ifnames[nifnames++], ifname);
+}
+
+static void print_info(const char *name, struct canlog *log)
+{
+	unsigned int i;
+
+	printf("%s: %s\n", name, log->cap ? "binary capture" : "candump log");
+	printf("  size %zu bytes\n", log->size);
+	if (log->cap)
+		printf("  frame blocks %llu (%llu compressed) with %llu "
+		       "uncompressed bytes\n", log->cap->blocks,
+		       log->cap->zblocks, log->cap->rawbytes);
+	printf("  frames %llu (CC %llu FD %llu XL %llu)\n",
+	       frames[XLCAP_CC] + frames[XLCAP_FD] + frames[XLCAP_XL],
+	       frames[XLCAP_CC], frames[XLCAP_FD], frames[XLCAP_XL]);
+	printf("  time (%ld.%06ld) .. (%ld.%06ld)\n", first.tv_sec,
+	       first.tv_nsec / 1000, last.tv_sec, last.tv_nsec / 1000);
+	printf("  interfaces");
+	for (i = 0; i < nifnames; i++)
+		printf(" %s", ifnames[i]);
+	printf("\n");
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "%s - convert between candump logs and binary captures\n\n", prg);
+	fprintf(stderr, "Usage: %s [options] <infile> [<outfile>]\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -b             (write a binary capture "
+		"- default: candump log)\n");
+	fprintf(stderr, "         -z             (compress the blocks of the "
+		"binary capture)\n");
+	fprintf(stderr, "         -i             (print information about "
+		"<infile> instead of converting)\n");
+	fprintf(stderr, "\nThe format of <infile> is detected automatically.\n");
+	fprintf(stderr, "Without <outfile> (or with '-') the output is written "
+		"to stdout.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int binary = 0;
+	int comp = 0;
+	int info = 0;
+
+	struct canlog log;
+	static struct canlog_frame lf;
+	struct xlcap_writer w;
+	const struct xlcap_rec *r;
+	const char *ifname;
+	const void *frame;
+	struct timespec ts;
+	unsigned int mtu;
+	FILE *out = stdout;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "bzih?")) != -1) {
+		switch (opt) {
+
+		case 'b':
+			binary = 1;
+			break;
+
+		case 'z':
+			comp = 1;
+			break;
+
+		case 'i':
+			info = 1;
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2 || (comp && !binary)) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
+	if (canlog_open(&log, argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (!info && argc - optind == 2 && strcmp(argv[optind + 1], "-")) {
+		out = fopen(argv[optind + 1], "w");
+		if (!out) {
+			perror(argv[optind + 1]);
+			return 1;
+		}
+	}
+	setvbuf(out, NULL, _IOFBF, OUTBUF_SIZE);
+
+	if (binary && !info && xlcap_create(&w, out, comp) < 0) {
+		perror("xlcap_create");
+		return 1;
+	}
+
+	while (1) {
+		if (log.cap) {
+			/* binary capture: frame content in place */
+			r = xlcap_next(log.cap);
+			if (!r) {
+				if (log.cap->err) {
+					fprintf(stderr, "%s: %s\n", argv[optind],
+						log.cap->err);
+					return 1;
+				}
+				break;
+			}
+			ts.tv_sec = r->sec;
+			ts.tv_nsec = r->nsec;
+			ifname = xlcap_ifname(log.cap, r);
+			frame = r->frame;
+			mtu = xlcap_type2mtu(r->type);
+		} else {
+			ret = canlog_read(&log, &lf);
+			if (!ret)
+				break;
+			if (ret < 0) {
+				fprintf(stderr, "%s: malformed line %u skipped\n",
+					argv[optind], log.line);
+				continue;
+			}
+			ts.tv_sec = lf.tv.tv_sec;
+			ts.tv_nsec = lf.tv.tv_usec * 1000;
+			ifname = lf.ifname;
+			frame = &lf.cc;
+			mtu = lf.mtu;
+		}
+
+		if (info) {
+			account(&ts, ifname, mtu);
+		} else if (!binary) {
+			print_line(out, &ts, ifname, frame, mtu);
+		} else if (xlcap_write(&w, &ts, ifname, frame, mtu) < 0) {
+			perror("xlcap_write");
+			return 1;
+		}
+	}
+
+	if (info)
+		print_info(argv[optind], &log);
+
+	if (binary && !info && xlcap_finish(&w) < 0) {
+		perror("xlcap_finish");
+		return 1;
+	}
+
+	if (fclose(out)) {
+		perror("fclose");
+		return 1;
+	}
+
+	canlog_close(&log);
+
+	return 0;
+}
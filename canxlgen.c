@@ -9,10 +9,15 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 
@@ -20,6 +25,7 @@
 #include <linux/can/raw.h>
 
 #include "printframe.h"
+#include "xlseq.h"
 
 #define DEFAULT_PRIO_ID 0x242
 #define DEFAULT_AF 0xAF1234AF
@@ -27,9 +33,645 @@
 #define DEFAULT_GAP 2
 #define DEFAULT_FROM 1
 #define DEFAULT_TO 2048
+#define DEFAULT_BATCH 32
+#define MAX_BATCH 64
+#define MAX_STREAMS 64
+#define MAX_WORKERS 64
+#define DEFAULT_SEED 1
 
 extern int optind, opterr, optopt;
 
+/* CAN XL frame header which is sent in front of the payload slice */
+struct xlgen_hdr {
+	canid_t prio;
+	__u8 flags;
+	__u8 sdt;
+	__u16 len;
+	__u32 af;
+};
+
+/*
+ * Precomputed payload for all lengths: The pattern (dlen + i) & 0xFF
+ * of a dlen byte frame starts at payload[dlen & 0xFF].
+ */
+static __u8 payload[256 + CANXL_MAX_DLEN];
+
+/* sendmmsg() batch of header/payload slice pairs (per thread) */
+static __thread struct xlgen_hdr txhdr[MAX_BATCH];
+static __thread struct iovec txiov[MAX_BATCH][3];
+static __thread struct mmsghdr txmsg[MAX_BATCH];
+static __thread __u8 txseq[MAX_BATCH][XLSEQ_SIZE];
+
+/* sequence number and TX timestamp payload header (-Q) */
+static int seqmode;
+static __u16 seqstream; /* stream ID (base) */
+
+/* length distributions of the multi-stream mode */
+enum {
+	DIST_FIXED,
+	DIST_UNIFORM,
+	DIST_HIST,
+};
+
+/* empirical length distribution: cumulative weights of the lengths */
+struct hist_bin {
+	unsigned int len;
+	unsigned long long cum;
+};
+
+/* one line of the multi-stream table */
+struct stream {
+	unsigned int id; /* index in the stream table */
+	canid_t prio;
+	__u8 vcid;
+	__u8 sec;
+	int dist;
+	unsigned int from, to; /* DIST_FIXED uses 'from' */
+	struct hist_bin *hist;
+	unsigned int nbins;
+	double rate; /* frames/s - 0 => unpaced */
+
+	/* runtime */
+	unsigned long long rnd; /* xorshift64* PRNG state */
+	unsigned long long interval, next; /* ns */
+	unsigned long long frames, bytes;
+	unsigned long long end; /* ns after start when -n frames were sent */
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	int cpu; /* -1 => not pinned */
+	struct stream *streams[MAX_STREAMS];
+	unsigned int nstreams;
+};
+
+static struct stream streams[MAX_STREAMS];
+static unsigned int nstreams;
+static struct worker workers[MAX_WORKERS];
+static unsigned int nworkers = 1;
+
+/* statistics */
+static unsigned long long frames, bytes;
+static volatile sig_atomic_t running = 1;
+
+static void sigterm(int signo)
+{
+	running = 0;
+}
+
+/* prepare the sendmmsg() batch with the common CAN XL frame header */
+static void init_batch(struct canxl_frame *cfx)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_BATCH; i++) {
+		memcpy(&txhdr[i], cfx, sizeof(struct xlgen_hdr));
+		txiov[i][0].iov_base = &txhdr[i];
+		txiov[i][0].iov_len = sizeof(struct xlgen_hdr);
+		txmsg[i].msg_hdr.msg_iov = txiov[i];
+		txmsg[i].msg_hdr.msg_iovlen = seqmode ? 3 : 2;
+	}
+}
+
+/* set the length and the payload slice(s) of the batch entry n */
+static void slice_frame(unsigned int n, unsigned int dlen, __u16 stream,
+			__u64 seq, __u64 ts)
+{
+	txhdr[n].len = dlen;
+
+	if (!seqmode) {
+		txiov[n][1].iov_base = &payload[dlen & 0xFF];
+		txiov[n][1].iov_len = dlen;
+		return;
+	}
+
+	/* sequence header followed by the remaining pattern */
+	xlseq_put(txseq[n], stream, seq, ts);
+	txiov[n][1].iov_base = txseq[n];
+	txiov[n][1].iov_len = XLSEQ_SIZE;
+	txiov[n][2].iov_base = &payload[(dlen & 0xFF) + XLSEQ_SIZE];
+	txiov[n][2].iov_len = dlen - XLSEQ_SIZE;
+}
+
+/* assemble the batch entry n for printing only */
+static void print_txframe(unsigned int n)
+{
+	struct canxl_frame cf;
+	unsigned int i, len = 0;
+
+	memcpy(&cf, &txhdr[n], sizeof(struct xlgen_hdr));
+	for (i = 1; i < txmsg[n].msg_hdr.msg_iovlen; i++) {
+		memcpy(&cf.data[len], txiov[n][i].iov_base, txiov[n][i].iov_len);
+		len += txiov[n][i].iov_len;
+	}
+	printxlframe(&cf);
+}
+
+/* open a CAN XL socket on ifname with optional VCID options */
+static int open_socket(const char *ifname,
+		       struct can_raw_vcid_options *vcid_opts)
+{
+	struct sockaddr_can addr;
+	int sockopt = 1;
+	int s, ret;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		exit(1);
+	}
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(ifname);
+
+	ret = setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+			 &sockopt, sizeof(sockopt));
+	if (ret < 0) {
+		perror("sockopt CAN_RAW_XL_FRAMES");
+		exit(1);
+	}
+
+	if (vcid_opts->flags) {
+		ret = setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
+				 vcid_opts, sizeof(*vcid_opts));
+		if (ret < 0) {
+			perror("sockopt CAN_RAW_XL_VCID_OPTS");
+			exit(1);
+		}
+	}
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	return s;
+}
+
+/*
+ * High-rate mode: send loops over the length range in sendmmsg() batches.
+ * Each batch is due when the frames (and data bytes) sent so far match the
+ * requested rate(s) which is waited for on absolute CLOCK_MONOTONIC times.
+ */
+static void send_highrate(int s, struct canxl_frame *cfx, unsigned int from,
+			  unsigned int to, unsigned int loops,
+			  unsigned int batch, double rate, double brate,
+			  int verbose)
+{
+	unsigned long long total = (unsigned long long)loops * (to - from + 1);
+	unsigned long long start, due, t;
+	unsigned int dlen = from;
+	unsigned int n, i, sent;
+	struct timespec ts;
+	int ret;
+
+	init_batch(cfx);
+
+	start = xlseq_now();
+
+	/* total == 0 => endless */
+	while (running && (!total || frames < total)) {
+
+		/* pace the batch on absolute time */
+		due = 0;
+		if (rate)
+			due = frames * 1e9 / rate;
+		if (brate && bytes * 1e9 / brate > due)
+			due = bytes * 1e9 / brate;
+		if (due) {
+			t = start + due;
+			ts.tv_sec = t / 1000000000ULL;
+			ts.tv_nsec = t % 1000000000ULL;
+			if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					    &ts, NULL))
+				continue; /* interrupted by a signal */
+		}
+
+		n = batch;
+		if (total && total - frames < n)
+			n = total - frames;
+
+		/* slice the payload for the next frames of the length range */
+		t = seqmode ? xlseq_now() : 0;
+		for (i = 0; i < n; i++) {
+			slice_frame(i, dlen, seqstream, frames + i, t);
+			dlen = (dlen == to) ? from : dlen + 1;
+		}
+
+		for (sent = 0; sent < n; sent += ret) {
+			ret = sendmmsg(s, &txmsg[sent], n - sent, 0);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret < 0) {
+				perror("sendmmsg can_frame");
+				exit(1);
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			frames++;
+			bytes += txhdr[i].len;
+
+			if (verbose)
+				print_txframe(i);
+		}
+	}
+
+	t = xlseq_now() - start;
+	if (!t)
+		t = 1;
+
+	fprintf(stderr, "sent %llu frames (%llu data bytes) in %.3f s\n",
+		frames, bytes, t / 1e9);
+	fprintf(stderr, "achieved %.0f frames/s, %.0f bytes/s", frames * 1e9 / t,
+		bytes * 1e9 / t);
+	if (rate)
+		fprintf(stderr, " - requested %.0f frames/s", rate);
+	if (brate)
+		fprintf(stderr, " - requested %.0f bytes/s", brate);
+	fprintf(stderr, "\n");
+}
+
+/* xorshift64* PRNG - reproducible per stream for a given seed */
+static unsigned long long stream_rnd(struct stream *st)
+{
+	st->rnd ^= st->rnd >> 12;
+	st->rnd ^= st->rnd << 25;
+	st->rnd ^= st->rnd >> 27;
+
+	return st->rnd * 0x2545F4914F6CDD1DULL;
+}
+
+/* next frame length of the stream length distribution */
+static unsigned int stream_len(struct stream *st)
+{
+	unsigned long long r;
+	unsigned int lo, hi, mid;
+
+	switch (st->dist) {
+	case DIST_UNIFORM:
+		return st->from + stream_rnd(st) % (st->to - st->from + 1);
+
+	case DIST_HIST:
+		/* binary search of the cumulative weights */
+		r = stream_rnd(st) % st->hist[st->nbins - 1].cum;
+		lo = 0;
+		hi = st->nbins - 1;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (st->hist[mid].cum > r)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return st->hist[lo].len;
+
+	default:
+		return st->from;
+	}
+}
+
+/* read the '<len> <weight>' lines of a length histogram */
+static int read_hist(struct stream *st, const char *name)
+{
+	char buf[256];
+	unsigned int len, nalloc = 0;
+	unsigned long long weight, cum = 0;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		if (buf[strspn(buf, " \t")] == '#')
+			continue;
+		if (sscanf(buf, "%u %llu", &len, &weight) != 2)
+			continue;
+		if (len < CANXL_MIN_DLEN || len > CANXL_MAX_DLEN) {
+			fprintf(stderr, "%s: illegal length %u\n", name, len);
+			fclose(f);
+			return -1;
+		}
+		if (!weight)
+			continue;
+
+		if (st->nbins == nalloc) {
+			nalloc = nalloc ? nalloc * 2 : 64;
+			st->hist = realloc(st->hist, nalloc * sizeof(*st->hist));
+			if (!st->hist) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		cum += weight;
+		st->hist[st->nbins].len = len;
+		st->hist[st->nbins].cum = cum;
+		st->nbins++;
+	}
+	fclose(f);
+
+	if (!st->nbins) {
+		fprintf(stderr, "%s: empty length histogram\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* parse the stream table - returns the number of streams or -1 */
+static int read_streams(const char *name)
+{
+	char buf[512], len[256], *p;
+	unsigned int prio, vcid, sec, lineno = 0;
+	double rate;
+	struct stream *st;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		lineno++;
+		p = buf + strspn(buf, " \t");
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+
+		if (nstreams == MAX_STREAMS) {
+			fprintf(stderr, "%s: more than %d streams\n", name,
+				MAX_STREAMS);
+			goto err;
+		}
+		st = &streams[nstreams];
+
+		if (sscanf(p, "%x %x %u %255s %lf", &prio, &vcid, &sec, len,
+			   &rate) != 5 || prio & ~CANXL_PRIO_MASK ||
+		    vcid > 0xFF || rate < 0)
+			goto syntax;
+
+		st->prio = prio;
+		st->vcid = vcid;
+		st->sec = sec ? CANXL_SEC : 0;
+		st->rate = rate;
+
+		if (sscanf(len, "fixed:%u", &st->from) == 1) {
+			st->dist = DIST_FIXED;
+			st->to = st->from;
+		} else if (sscanf(len, "uniform:%u:%u", &st->from,
+				  &st->to) == 2) {
+			st->dist = DIST_UNIFORM;
+		} else if (!strncmp(len, "hist:", 5)) {
+			st->dist = DIST_HIST;
+			if (read_hist(st, len + 5) < 0)
+				goto err;
+			st->from = CANXL_MIN_DLEN;
+			st->to = CANXL_MAX_DLEN;
+		} else {
+			goto syntax;
+		}
+
+		if (st->from < CANXL_MIN_DLEN || st->to > CANXL_MAX_DLEN ||
+		    st->from > st->to)
+			goto syntax;
+
+		nstreams++;
+	}
+	fclose(f);
+
+	if (!nstreams) {
+		fprintf(stderr, "%s: no streams\n", name);
+		return -1;
+	}
+
+	return nstreams;
+
+syntax:
+	fprintf(stderr, "%s: line %u: syntax error\n", name, lineno);
+err:
+	fclose(f);
+	return -1;
+}
+
+/* splitmix64 - derives independent PRNG states from the seed */
+static unsigned long long splitmix64(unsigned long long x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+	return x ^ (x >> 31);
+}
+
+/* multi-stream mode arguments for the generator threads */
+static const char *gen_ifname;
+static struct canxl_frame *gen_cfx;
+static struct can_raw_vcid_options *gen_vcid_opts;
+static unsigned int gen_batch;
+static unsigned long long gen_maxframes; /* per stream - 0 => endless */
+static int gen_verbose;
+
+/*
+ * Send the due frames of the worker streams in sendmmsg() batches.
+ * Each stream is paced on absolute times (start + n * interval) and
+ * the first stream to serve rotates to avoid starvation by unpaced
+ * streams.
+ */
+static void gen_loop(struct worker *w)
+{
+	unsigned long long start, t, due;
+	unsigned int i, j, n, sent, first = 0;
+	unsigned int dlen;
+	struct stream *st;
+	struct timespec ts;
+	int active, s, ret;
+
+	s = open_socket(gen_ifname, gen_vcid_opts);
+	init_batch(gen_cfx);
+
+	start = xlseq_now();
+
+	while (running) {
+		t = xlseq_now() - start;
+		due = t + 100000000; /* check 'running' at least every 100ms */
+		active = 0;
+		n = 0;
+
+		for (j = 0; j < w->nstreams; j++) {
+			st = w->streams[(first + j) % w->nstreams];
+
+			while (n < gen_batch && st->next <= t &&
+			       (!gen_maxframes || st->frames < gen_maxframes)) {
+				dlen = stream_len(st);
+				if (seqmode && dlen < XLSEQ_SIZE)
+					dlen = XLSEQ_SIZE;
+				txhdr[n].prio = st->prio |
+					(st->vcid << CANXL_VCID_OFFSET);
+				txhdr[n].flags = CANXL_XLF | st->sec |
+					(st->vcid ? CANXL_VCID : 0);
+				slice_frame(n, dlen, seqstream + st->id,
+					    st->frames, start + t);
+				st->next += st->interval;
+				st->frames++;
+				st->bytes += dlen;
+				n++;
+			}
+
+			if (gen_maxframes && st->frames >= gen_maxframes) {
+				if (!st->end)
+					st->end = xlseq_now() - start;
+				continue;
+			}
+
+			active = 1;
+			if (st->next < due)
+				due = st->next;
+		}
+		first++;
+
+		for (sent = 0; sent < n; sent += ret) {
+			ret = sendmmsg(s, &txmsg[sent], n - sent, 0);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret < 0) {
+				perror("sendmmsg can_frame");
+				exit(1);
+			}
+		}
+
+		if (gen_verbose && n) {
+			flockfile(stdout);
+			for (i = 0; i < n; i++)
+				print_txframe(i);
+			funlockfile(stdout);
+		}
+
+		if (!active)
+			break;
+
+		if (n || due <= t)
+			continue;
+
+		t = start + due;
+		ts.tv_sec = t / 1000000000ULL;
+		ts.tv_nsec = t % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	close(s);
+}
+
+static void *gen_thread(void *arg)
+{
+	struct worker *w = arg;
+	cpu_set_t cpus;
+
+	if (w->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(w->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+			fprintf(stderr, "worker %u: can not pin to CPU %d\n",
+				w->id, w->cpu);
+	}
+
+	gen_loop(w);
+
+	return NULL;
+}
+
+/* multi-stream mode: distribute the streams round robin to the workers */
+static int run_streams(const char *ifname, const char *streamfile,
+		       struct canxl_frame *cfx,
+		       struct can_raw_vcid_options *vcid_opts,
+		       unsigned int batch, unsigned long long seed,
+		       unsigned long long maxframes, int verbose)
+{
+	unsigned long long t, start;
+	struct stream *st;
+	unsigned int i;
+	int ncpus;
+
+	if (read_streams(streamfile) < 0)
+		return 1;
+
+	for (i = 0; i < nstreams; i++) {
+		st = &streams[i];
+		st->id = i;
+		st->rnd = splitmix64(seed + i);
+		if (!st->rnd)
+			st->rnd = 1;
+		st->interval = st->rate ? 1e9 / st->rate : 0;
+
+		/* frames with VCID content need the VCID pass through */
+		if (st->vcid)
+			vcid_opts->flags |= CAN_RAW_XL_VCID_TX_PASS;
+	}
+
+	gen_ifname = ifname;
+	gen_cfx = cfx;
+	gen_vcid_opts = vcid_opts;
+	gen_batch = batch;
+	gen_maxframes = maxframes;
+	gen_verbose = verbose;
+
+	if (nworkers > nstreams)
+		nworkers = nstreams;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (i = 0; i < nworkers; i++) {
+		workers[i].id = i;
+		workers[i].cpu = (nworkers > 1) ? (int)i % ncpus : -1;
+	}
+
+	for (i = 0; i < nstreams; i++) {
+		struct worker *w = &workers[i % nworkers];
+
+		w->streams[w->nstreams++] = &streams[i];
+	}
+
+	start = xlseq_now();
+
+	if (nworkers == 1) {
+		gen_loop(&workers[0]);
+	} else {
+		for (i = 0; i < nworkers; i++) {
+			if (pthread_create(&workers[i].thread, NULL, gen_thread,
+					   &workers[i])) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+		for (i = 0; i < nworkers; i++)
+			pthread_join(workers[i].thread, NULL);
+	}
+
+	t = xlseq_now() - start;
+	if (!t)
+		t = 1;
+
+	fprintf(stderr, "stream  prio  vcid  worker      frames   data bytes  "
+		"   frames/s   requested\n");
+	for (i = 0; i < nstreams; i++) {
+		st = &streams[i];
+		fprintf(stderr, "%6u   %03X    %02X  %6u  %10llu  %11llu  %11.0f  %10.0f\n",
+			i, st->prio, st->vcid, i % nworkers, st->frames,
+			st->bytes, st->frames * 1e9 / (st->end ? st->end : t),
+			st->rate);
+	}
+	fprintf(stderr, "%.3f s\n", t / 1e9);
+
+	return 0;
+}
+
 void print_usage(char *prg)
 {
 	fprintf(stderr, "%s - CAN XL frame generator\n\n", prg);
@@ -49,7 +691,35 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -V <vcid>      (set virtual CAN network ID)\n");
 	fprintf(stderr, "         -W <vcid>      (pass virtual CAN network ID)\n");
 	fprintf(stderr, "         -P             (create data pattern)\n");
+	fprintf(stderr, "         -Q             (sequence number and TX timestamp "
+		"header before the pattern)\n");
+	fprintf(stderr, "         -i <id>        (-Q stream ID (base) "
+		"- default: 0)\n");
 	fprintf(stderr, "         -v             (verbose)\n");
+	fprintf(stderr, "High-rate mode options:\n");
+	fprintf(stderr, "         -r <rate>      (frames/s - 0: unpaced)\n");
+	fprintf(stderr, "         -R <rate>      (data bytes/s - 0: unpaced)\n");
+	fprintf(stderr, "         -b <batch>     (frames per sendmmsg "
+		"- default: %d, max %d)\n", DEFAULT_BATCH, MAX_BATCH);
+	fprintf(stderr, "         -n <loops>     (loops over the length range "
+		"- default: 1, 0: endless)\n");
+	fprintf(stderr, "Multi-stream mode options:\n");
+	fprintf(stderr, "         -m <streamfile> (stream table - see below)\n");
+	fprintf(stderr, "         -w <workers>   (pinned generator threads "
+		"- default: 1)\n");
+	fprintf(stderr, "         -e <seed>      (PRNG seed "
+		"- default: %d)\n", DEFAULT_SEED);
+	fprintf(stderr, "         -n <frames>    (frames per stream "
+		"- default: 0, endless)\n");
+	fprintf(stderr, "\nThe high-rate mode is enabled by -r, -R or -b. It ignores the gap\n"
+		"and reports the achieved rate on exit or SIGINT/SIGTERM.\n");
+	fprintf(stderr, "\nThe stream table has one stream per line (AF/SDT/-P from the options):\n"
+		"  <prio> <vcid> <sec> <length> <frames/s>\n"
+		"with <length> fixed:<len>, uniform:<from>:<to> or hist:<file>\n"
+		"where <file> has '<len> <weight>' lines. '#' starts a comment.\n"
+		"With -Q the stream ID is the base (-i) plus the line index and\n"
+		"lengths below %d are sent with %d bytes.\n"
+		"Example: 242 00 0 uniform:1:2048 1000\n", XLSEQ_SIZE, XLSEQ_SIZE);
 }
 
 int main(int argc, char **argv)
@@ -66,16 +736,21 @@ int main(int argc, char **argv)
 	__u8 vcid = 0;
 	__u8 vcid_pass = 0;
 	int verbose = 0;
+	double rate = 0;
+	double brate = 0;
+	unsigned int batch = 0;
+	int loops = -1; /* default depends on the mode */
+	char *streamfile = NULL;
+	unsigned long long seed = DEFAULT_SEED;
 
 	int s;
-	struct sockaddr_can addr;
+	struct sigaction sa = { .sa_handler = sigterm };
 	struct can_raw_vcid_options vcid_opts = {};
 	struct timespec ts;
 	struct canxl_frame cfx = {0};
-	int nbytes, ret, dlen, i;
-	int sockopt = 1;
+	int nbytes, dlen, i;
 
-	while ((opt = getopt(argc, argv, "l:g:p:A:S:sV:W:Pvh?")) != -1) {
+	while ((opt = getopt(argc, argv, "l:g:p:A:S:sV:W:Pr:R:b:n:m:w:e:Qi:vh?")) != -1) {
 		switch (opt) {
 
 		case 'l':
@@ -132,6 +807,55 @@ int main(int argc, char **argv)
 			create_pattern = 1;
 			break;
 
+		case 'r':
+			rate = strtod(optarg, NULL);
+			if (!batch)
+				batch = DEFAULT_BATCH;
+			break;
+
+		case 'R':
+			brate = strtod(optarg, NULL);
+			if (!batch)
+				batch = DEFAULT_BATCH;
+			break;
+
+		case 'b':
+			batch = strtoul(optarg, NULL, 10);
+			if (batch < 1 || batch > MAX_BATCH) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'n':
+			loops = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'Q':
+			seqmode = 1;
+			create_pattern = 1;
+			break;
+
+		case 'i':
+			seqstream = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'm':
+			streamfile = optarg;
+			break;
+
+		case 'w':
+			nworkers = strtoul(optarg, NULL, 10);
+			if (nworkers < 1 || nworkers > MAX_WORKERS) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'e':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+
 		case 'v':
 			verbose = 1;
 			break;
@@ -150,6 +874,12 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
+	/* the sequence header has to fit into all frames */
+	if (seqmode && !streamfile && from < XLSEQ_SIZE) {
+		fprintf(stderr, "-Q needs a minimum length of %d\n", XLSEQ_SIZE);
+		return 1;
+	}
+
 	ts.tv_sec = gap / 1000;
 	ts.tv_nsec = (long)(((long long)(gap * 1000000)) % 1000000000LL);
 
@@ -158,21 +888,6 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-	if (s < 0) {
-		perror("socket");
-		return 1;
-	}
-	addr.can_family = AF_CAN;
-	addr.can_ifindex = if_nametoindex(argv[optind]);
-
-	ret = setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
-			 &sockopt, sizeof(sockopt));
-	if (ret < 0) {
-		perror("sockopt CAN_RAW_XL_FRAMES");
-		exit(1);
-	}
-
 	cfx.prio = prio;
 	cfx.flags = (CANXL_XLF | sec_bit);
 	cfx.sdt = sdt;
@@ -193,18 +908,29 @@ int main(int argc, char **argv)
 		vcid_opts.flags |= CAN_RAW_XL_VCID_TX_SET;
 	}
 
-	if (vcid || vcid_pass) {
-		ret = setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
-				 &vcid_opts, sizeof(vcid_opts));
-		if (ret < 0) {
-			perror("sockopt CAN_RAW_XL_VCID_OPTS");
-			exit(1);
-		}
+	if (create_pattern)
+		for (i = 0; i < (int)sizeof(payload); i++)
+			payload[i] = i & 0xFFU;
+
+	if (streamfile) {
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+
+		return run_streams(argv[optind], streamfile, &cfx, &vcid_opts,
+				   batch ? batch : DEFAULT_BATCH, seed,
+				   loops < 0 ? 0 : loops, verbose);
 	}
 
-	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
-		return 1;
+	s = open_socket(argv[optind], &vcid_opts);
+
+	if (batch) {
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+
+		send_highrate(s, &cfx, from, to, loops < 0 ? 1 : loops, batch,
+			      rate, brate, verbose);
+		close(s);
+		return 0;
 	}
 
 	for (dlen = from; dlen <= to; dlen++) {
@@ -215,6 +941,9 @@ int main(int argc, char **argv)
 			for (i = 0; i < dlen; i++)
 				cfx.data[i] = (dlen + i) & 0xFFU;
 
+		if (seqmode)
+			xlseq_put(cfx.data, seqstream, dlen - from, xlseq_now());
+
 		/* write CAN XL frame */
 		nbytes = write(s, &cfx, CANXL_HDR_SIZE + dlen);
 		if (nbytes != CANXL_HDR_SIZE + dlen) {
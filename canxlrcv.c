@@ -9,22 +9,643 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <poll.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
 
 #include <linux/sockios.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
 
 #include "printframe.h"
+#include "xlseq.h"
+#include "xlcap.h"
 
 #define ANYDEV "any"
+#define SEQ_WINDOW 1024 /* sequence numbers to detect duplicates */
+#define LAT_BINS 32 /* log2 microsecond latency histogram */
+#define MAX_BATCH 64 /* frames per recvmmsg() */
+#define MAX_IFCACHE 64
+#define RTNL_CHECK 256 /* check link notifications every n batches under load */
+#define RING_BLOCK_SIZE (1 << 20)
+#define RING_BLOCKS 16
+#define RING_FRAME_SIZE 4096 /* max. snap length for CAN XL frames */
+#define RING_BLOCK_TMO 10 /* ms to retire a partially filled block */
 
 extern int optind, opterr, optopt;
 
+/* per stream statistics of the sequence analysis (-Q) */
+struct seqstat {
+	unsigned long long rx, lost, dups, reordered, corrupt;
+	__u64 maxseq;
+	__u64 window[SEQ_WINDOW / 64]; /* received seq % SEQ_WINDOW */
+	__u64 latmin, latmax, latsum; /* ns */
+	unsigned long long lat[LAT_BINS];
+};
+
+union canxl_rx {
+	struct can_frame cc;
+	struct canfd_frame fd;
+	struct canxl_frame xl;
+};
+
+/* recvmmsg() batch with timestamp control messages */
+static union canxl_rx rxbuf[MAX_BATCH];
+static struct sockaddr_can rxaddr[MAX_BATCH];
+static struct iovec rxiov[MAX_BATCH];
+static struct mmsghdr rxmsg[MAX_BATCH];
+static char rxctrl[MAX_BATCH][CMSG_SPACE(sizeof(struct scm_timestamping)) +
+			       CMSG_SPACE(sizeof(struct timespec))];
+
+/* ifindex -> name cache which is updated by rtnetlink link notifications */
+struct ifcache {
+	int ifindex;
+	char name[IFNAMSIZ];
+};
+
+static struct ifcache ifcache[MAX_IFCACHE];
+static unsigned int nifcache;
+
+static int check_pattern;
+static int hwstamp; /* print hardware timestamps when available */
+static int max_devname_len; /* to prevent frazzled device name output */
+
+/* binary capture (-w) instead of the text output */
+static struct xlcap_writer capw;
+static int capture;
+
+static struct seqstat *seqstats[1 << 16];
+static unsigned long long noseq; /* XL frames without sequence header */
+static volatile sig_atomic_t running = 1;
+
+static void sigterm(int signo)
+{
+	running = 0;
+}
+
+static inline int seq_test(struct seqstat *st, __u64 seq)
+{
+	return (st->window[(seq % SEQ_WINDOW) / 64] >> (seq % 64)) & 1;
+}
+
+static inline void seq_set(struct seqstat *st, __u64 seq, int val)
+{
+	__u64 *w = &st->window[(seq % SEQ_WINDOW) / 64];
+
+	if (val)
+		*w |= 1ULL << (seq % 64);
+	else
+		*w &= ~(1ULL << (seq % 64));
+}
+
+/*
+ * Sequence numbers behind the highest received one are first counted
+ * as lost. When they arrive later they are counted as reordered
+ * (or as duplicate when they have been seen within SEQ_WINDOW).
+ */
+static void seq_account(struct seqstat *st, __u64 seq)
+{
+	__u64 s;
+
+	if (!st->rx++) {
+		st->maxseq = seq;
+		seq_set(st, seq, 1);
+		return;
+	}
+
+	if (seq > st->maxseq) {
+		st->lost += seq - st->maxseq - 1;
+		if (seq - st->maxseq >= SEQ_WINDOW)
+			memset(st->window, 0, sizeof(st->window));
+		else
+			for (s = st->maxseq + 1; s < seq; s++)
+				seq_set(st, s, 0);
+		seq_set(st, seq, 1);
+		st->maxseq = seq;
+		return;
+	}
+
+	/* too old to distinguish a duplicate from a late frame */
+	if (st->maxseq - seq >= SEQ_WINDOW) {
+		st->reordered++;
+		if (st->lost)
+			st->lost--;
+		return;
+	}
+
+	if (seq_test(st, seq)) {
+		st->dups++;
+		return;
+	}
+
+	seq_set(st, seq, 1);
+	st->reordered++;
+	/* not counted as lost when the stream started behind it */
+	if (st->lost)
+		st->lost--;
+}
+
+static void seq_frame(struct canxl_frame *cfx, __u64 rxts)
+{
+	struct seqstat *st;
+	__u16 stream;
+	__u64 seq, ts, lat;
+	unsigned int i, bin;
+
+	if (xlseq_get(cfx->data, cfx->len, &stream, &seq, &ts) < 0) {
+		noseq++;
+		return;
+	}
+
+	st = seqstats[stream];
+	if (!st) {
+		st = calloc(1, sizeof(*st));
+		if (!st) {
+			perror("calloc");
+			exit(1);
+		}
+		st->latmin = ~0ULL;
+		seqstats[stream] = st;
+	}
+
+	seq_account(st, seq);
+
+	/* data pattern behind the sequence header */
+	for (i = XLSEQ_SIZE; i < cfx->len; i++) {
+		if (cfx->data[i] != ((cfx->len + i) & 0xFFU)) {
+			st->corrupt++;
+			break;
+		}
+	}
+
+	/* one-way latency */
+	lat = (rxts > ts) ? rxts - ts : 0;
+	if (lat < st->latmin)
+		st->latmin = lat;
+	if (lat > st->latmax)
+		st->latmax = lat;
+	st->latsum += lat;
+
+	lat /= 1000;
+	for (bin = 0; lat && bin < LAT_BINS - 1; bin++)
+		lat >>= 1;
+	st->lat[bin]++;
+}
+
+static void print_seqstats(void)
+{
+	struct seqstat *st;
+	unsigned int stream, bin;
+
+	for (stream = 0; stream < (1 << 16); stream++) {
+		st = seqstats[stream];
+		if (!st)
+			continue;
+
+		fprintf(stderr, "stream %u: rx %llu lost %llu dup %llu "
+			"reordered %llu corrupt %llu\n", stream, st->rx,
+			st->lost, st->dups, st->reordered, st->corrupt);
+		fprintf(stderr, "  latency min %.1f avg %.1f max %.1f us\n",
+			st->latmin / 1e3, st->latsum / 1e3 / st->rx,
+			st->latmax / 1e3);
+
+		for (bin = 0; bin < LAT_BINS; bin++) {
+			if (!st->lat[bin])
+				continue;
+			if (!bin)
+				fprintf(stderr, "  [%8s, %8u) us: %llu\n", "0", 1,
+					st->lat[bin]);
+			else
+				fprintf(stderr, "  [%8u, %8u) us: %llu\n",
+					1U << (bin - 1), 1U << bin, st->lat[bin]);
+		}
+	}
+
+	if (noseq)
+		fprintf(stderr, "CAN XL frames without sequence header: %llu\n",
+			noseq);
+}
+
+static const char *ifcache_name(int ifindex)
+{
+	struct ifcache *c;
+	unsigned int i;
+
+	for (i = 0; i < nifcache; i++)
+		if (ifcache[i].ifindex == ifindex)
+			return ifcache[i].name;
+
+	/* replace an entry when the cache is full */
+	c = &ifcache[nifcache < MAX_IFCACHE ? nifcache++ : ifindex % MAX_IFCACHE];
+	if (!if_indextoname(ifindex, c->name)) {
+		c->ifindex = 0;
+		return NULL;
+	}
+	c->ifindex = ifindex;
+
+	return c->name;
+}
+
+/* subscribe to link notifications - returns the socket or -1 */
+static int open_rtnl(void)
+{
+	struct sockaddr_nl snl = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
+	int nl;
+
+	nl = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (nl < 0)
+		return -1;
+
+	if (bind(nl, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		close(nl);
+		return -1;
+	}
+
+	return nl;
+}
+
+/* process pending RTM_NEWLINK/RTM_DELLINK notifications */
+static void ifcache_update(int nl)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nh;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	unsigned int i, len;
+	int ret;
+
+	while ((ret = recv(nl, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned int)ret);
+		     nh = NLMSG_NEXT(nh, ret)) {
+			if (nh->nlmsg_type != RTM_NEWLINK &&
+			    nh->nlmsg_type != RTM_DELLINK)
+				continue;
+
+			ifi = NLMSG_DATA(nh);
+			for (i = 0; i < nifcache; i++)
+				if (ifcache[i].ifindex == ifi->ifi_index)
+					break;
+			if (i == nifcache)
+				continue; /* not cached */
+
+			if (nh->nlmsg_type == RTM_DELLINK) {
+				ifcache[i] = ifcache[--nifcache];
+				continue;
+			}
+
+			len = IFLA_PAYLOAD(nh);
+			for (rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+			     rta = RTA_NEXT(rta, len)) {
+				if (rta->rta_type == IFLA_IFNAME) {
+					strncpy(ifcache[i].name, RTA_DATA(rta),
+						IFNAMSIZ - 1);
+					ifcache[i].name[IFNAMSIZ - 1] = 0;
+				}
+			}
+		}
+	}
+}
+
+/* get the (hardware) timestamp from the control messages */
+static void rx_stamp(struct msghdr *msg, struct timespec *rxts)
+{
+	struct cmsghdr *cmsg;
+	struct scm_timestamping *stamp;
+	struct timespec *ts = NULL;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			stamp = (struct scm_timestamping *)CMSG_DATA(cmsg);
+			ts = &stamp->ts[0];
+			if (hwstamp && (stamp->ts[2].tv_sec || stamp->ts[2].tv_nsec))
+				ts = &stamp->ts[2];
+		} else if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			ts = (struct timespec *)CMSG_DATA(cmsg);
+		}
+	}
+
+	if (!ts) {
+		rxts->tv_sec = 0;
+		rxts->tv_nsec = 0;
+		return;
+	}
+
+	*rxts = *ts;
+}
+
+/*
+ * offset of the CLOCK_REALTIME rx timestamps to the CLOCK_MONOTONIC
+ * clock of the xlseq TX timestamps (-Q latency)
+ */
+static __u64 xlseq_rtoff(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec - xlseq_now();
+}
+
+/* print or capture a received frame - returns 0 or 1 to terminate */
+static int rx_frame(union canxl_rx *can, int nbytes, struct timespec *ts,
+		    int ifindex)
+{
+	const char *ifname;
+	unsigned int mtu;
+	int i;
+
+	ifname = ifcache_name(ifindex);
+	if (!ifname) {
+		perror("if_indextoname");
+		return 1;
+	}
+
+	if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
+		fprintf(stderr, "read: no CAN frame\n");
+		return 1;
+	}
+
+	if (can->xl.flags & CANXL_XLF) {
+		if (nbytes != CANXL_HDR_SIZE + can->xl.len) {
+			printf("nbytes = %d\n", nbytes);
+			fprintf(stderr, "read: no CAN XL frame\n");
+			return 1;
+		}
+
+		if (check_pattern) {
+			for (i = 0; i < can->xl.len; i++) {
+				if (can->xl.data[i] != ((can->xl.len + i) & 0xFFU)) {
+					fprintf(stderr, "check pattern failed %02X %04X\n",
+						can->xl.data[i], can->xl.len + i);
+					return 1;
+				}
+			}
+		}
+		mtu = CANXL_MTU;
+	} else if (nbytes == CANFD_MTU || nbytes == CAN_MTU) {
+		mtu = nbytes;
+	} else {
+		fprintf(stderr, "read: incomplete CAN(FD) frame\n");
+		return 1;
+	}
+
+	if (capture) {
+		if (xlcap_write(&capw, ts, ifname, can, mtu) < 0) {
+			perror("capture");
+			return 1;
+		}
+		return 0;
+	}
+
+	printf("(%ld.%06ld) ", ts->tv_sec, ts->tv_nsec / 1000);
+
+	if (max_devname_len < (int)strlen(ifname))
+		max_devname_len = strlen(ifname);
+	printf("%*s ", max_devname_len, ifname);
+
+	if (mtu == CANXL_MTU)
+		printxlframe(&can->xl);
+	else if (mtu == CANFD_MTU)
+		printfdframe(&can->fd);
+	else
+		printccframe(&can->cc);
+
+	return 0;
+}
+
+/* flush stdout and the capture before waiting - returns the poll timeout */
+static int rx_idle(void)
+{
+	int timeout;
+
+	fflush(stdout);
+
+	if (!capture)
+		return -1;
+
+	timeout = xlcap_idle(&capw);
+	if (timeout == -2) {
+		perror("capture");
+		exit(1);
+	}
+
+	return timeout;
+}
+
+/*
+ * AF_PACKET TPACKET_V3 capture (-R): The kernel fills the frames of all
+ * CAN interfaces into a memory mapped block ring. Full blocks are handed
+ * over to user space and processed without per frame syscalls/copies.
+ */
+static int ring_capture(const char *ifname, int seqmode, int vcid,
+			struct can_raw_vcid_options *vcid_opts)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_BLOCKS,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCKS,
+		.tp_retire_blk_tov = RING_BLOCK_TMO,
+	};
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+	};
+	struct tpacket_stats_v3 st;
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	struct sockaddr_ll *from;
+	struct pollfd pfd;
+	struct timespec ts;
+	union canxl_rx *can;
+	canid_t vcid_mask = (canid_t)vcid_opts->rx_vcid_mask << CANXL_VCID_OFFSET;
+	canid_t vcid_val = (canid_t)vcid_opts->rx_vcid << CANXL_VCID_OFFSET;
+	socklen_t len = sizeof(st);
+	unsigned int blk = 0, i;
+	int version = TPACKET_V3;
+	int tsflags = SOF_TIMESTAMPING_RAW_HARDWARE;
+	__u64 rtoff = 0;
+	__u8 *ring;
+	int s, ret = 0;
+
+	s = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (s < 0) {
+		perror("socket AF_PACKET");
+		return 1;
+	}
+
+	if (setsockopt(s, SOL_PACKET, PACKET_VERSION,
+		       &version, sizeof(version)) < 0) {
+		perror("sockopt PACKET_VERSION");
+		return 1;
+	}
+
+	/* tp_sec/tp_nsec with the raw hardware timestamp when available */
+	if (hwstamp)
+		setsockopt(s, SOL_PACKET, PACKET_TIMESTAMP,
+			   &tsflags, sizeof(tsflags));
+
+	if (setsockopt(s, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		perror("sockopt PACKET_RX_RING");
+		return 1;
+	}
+
+	ring = mmap(NULL, req.tp_block_size * req.tp_block_nr,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, s, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (strcmp(ifname, ANYDEV) != 0) {
+		sll.sll_ifindex = if_nametoindex(ifname);
+		if (!sll.sll_ifindex) {
+			perror(ifname);
+			return 1;
+		}
+	}
+
+	if (bind(s, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	pfd.fd = s;
+	pfd.events = POLLIN | POLLERR;
+
+	while (running) {
+		bd = (struct tpacket_block_desc *)(ring + blk * req.tp_block_size);
+
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER)) {
+			if (poll(&pfd, 1, rx_idle()) < 0 && errno != EINTR) {
+				perror("poll");
+				ret = 1;
+				break;
+			}
+			continue;
+		}
+
+		/*
+		 * offset of the CLOCK_REALTIME packet timestamps to the
+		 * CLOCK_MONOTONIC xlseq clock - the block may have been
+		 * retired up to RING_BLOCK_TMO ms after its first packet
+		 */
+		if (seqmode)
+			rtoff = xlseq_rtoff();
+
+		hdr = (struct tpacket3_hdr *)((__u8 *)bd +
+					      bd->hdr.bh1.offset_to_first_pkt);
+
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++,
+		     hdr = (struct tpacket3_hdr *)((__u8 *)hdr + hdr->tp_next_offset)) {
+			from = (struct sockaddr_ll *)((__u8 *)hdr +
+				TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			/* CAN CC/FD/XL frames only */
+			if (from->sll_hatype != ARPHRD_CAN)
+				continue;
+
+			/*
+			 * A locally sent frame passes the tap twice on vcan
+			 * (echo=0): as PACKET_OUTGOING copy from the tx path
+			 * and as loopback frame of the CAN core. CAN_RAW only
+			 * delivers the loopback frame - skip the tx copy.
+			 */
+			if (from->sll_pkttype == PACKET_OUTGOING)
+				continue;
+
+			can = (union canxl_rx *)((__u8 *)hdr + hdr->tp_mac);
+
+			/* the CAN_RAW VCID handling in software */
+			if (hdr->tp_snaplen >= CANXL_HDR_SIZE &&
+			    can->xl.flags & CANXL_XLF) {
+				if (vcid) {
+					if ((can->xl.prio & vcid_mask) !=
+					    (vcid_val & vcid_mask))
+						continue;
+				} else if (can->xl.prio & CANXL_VCID_MASK) {
+					continue;
+				}
+			}
+
+			if (seqmode) {
+				if (hdr->tp_snaplen >= CANXL_HDR_SIZE + CANXL_MIN_DLEN &&
+				    can->xl.flags & CANXL_XLF &&
+				    hdr->tp_snaplen == CANXL_HDR_SIZE + can->xl.len)
+					seq_frame(&can->xl, hdr->tp_sec *
+						  1000000000ULL +
+						  hdr->tp_nsec - rtoff);
+				continue;
+			}
+
+			ts.tv_sec = hdr->tp_sec;
+			ts.tv_nsec = hdr->tp_nsec;
+			if (rx_frame(can, hdr->tp_snaplen, &ts, from->sll_ifindex)) {
+				running = 0;
+				ret = 1;
+				break;
+			}
+		}
+
+		/* hand the block back to the kernel */
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		blk = (blk + 1) % req.tp_block_nr;
+	}
+
+	fflush(stdout);
+
+	if (getsockopt(s, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+		perror("getsockopt PACKET_STATISTICS");
+	} else {
+		fprintf(stderr, "ring: %u packets, %u drops, %u queue freezes\n",
+			st.tp_packets, st.tp_drops, st.tp_freeze_q_cnt);
+	}
+
+	if (seqmode)
+		print_seqstats();
+
+	munmap(ring, req.tp_block_size * req.tp_block_nr);
+	close(s);
+
+	return ret;
+}
+
+/* write the last capture block - returns 0 or 1 on errors */
+static int finish_capture(void)
+{
+	if (xlcap_finish(&capw) < 0 || fclose(capw.f)) {
+		perror("capture");
+		return 1;
+	}
+
+	fprintf(stderr, "captured %llu frames into %llu bytes "
+		"(%llu bytes uncompressed)\n", capw.frames, capw.bytes,
+		capw.rawbytes);
+
+	return 0;
+}
+
 void print_usage(char *prg)
 {
 	fprintf(stderr, "%s - CAN XL frame receiver\n\n", prg);
@@ -32,8 +653,21 @@ void print_usage(char *prg)
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "         -V <vcid>:<vcid_mask> (VCID filter)\n");
 	fprintf(stderr, "         -P (check data pattern)\n");
+	fprintf(stderr, "         -Q (analyse canxlgen -Q sequence numbers and TX timestamps)\n");
+	fprintf(stderr, "         -H (print hardware timestamps when available)\n");
+	fprintf(stderr, "         -R (capture with AF_PACKET TPACKET_V3 ring)\n");
+	fprintf(stderr, "         -F (print the full CAN XL payload)\n");
+	fprintf(stderr, "         -w <file> (write a binary capture instead of "
+		"printing the frames - not with -Q)\n");
+	fprintf(stderr, "         -z (compress the blocks of the binary capture)\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Use interface name '%s' to receive from all CAN interfaces.\n", ANYDEV);
+	fprintf(stderr, "With -Q the frames are not printed. Loss, duplicates, reordering and the\n"
+		"one-way latency per stream are reported on SIGINT/SIGTERM. The latency\n"
+		"is measured up to the kernel rx timestamp of each frame (-H is ignored).\n");
+	fprintf(stderr, "With -R the kernel ring drop statistics are reported on SIGINT/SIGTERM.\n");
+	fprintf(stderr, "With -w the capture is completed on SIGINT/SIGTERM "
+		"('-' writes to stdout).\n");
 }
 
 int main(int argc, char **argv)
@@ -44,19 +678,24 @@ int main(int argc, char **argv)
 	struct sockaddr_can addr;
 	struct ifreq ifr;
 	int ifindex = 0;
-	int max_devname_len = 0; /* to prevent frazzled device name output */
-	int nbytes, ret, i;
+	int nbytes, ret, i, n;
 	int sockopt = 1;
 	int vcid = 0;
-	int check_pattern = 0;
-	struct timeval tv;
-	union {
-		struct can_frame cc;
-		struct canfd_frame fd;
-		struct canxl_frame xl;
-	} can;
-
-	while ((opt = getopt(argc, argv, "V:Ph?")) != -1) {
+	int seqmode = 0;
+	int ringmode = 0;
+	int tsflags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+		SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+	struct sigaction sa = { .sa_handler = sigterm };
+	struct pollfd pfd[2];
+	unsigned long long batches = 0;
+	struct timespec ts;
+	char *capname = NULL;
+	FILE *capf = stdout;
+	int comp = 0;
+	__u64 rxts, rtoff;
+	int nl;
+
+	while ((opt = getopt(argc, argv, "V:PQHRFw:zh?")) != -1) {
 		switch (opt) {
 
 		case 'V':
@@ -73,6 +712,30 @@ int main(int argc, char **argv)
 			check_pattern = 1;
 			break;
 
+		case 'Q':
+			seqmode = 1;
+			break;
+
+		case 'H':
+			hwstamp = 1;
+			break;
+
+		case 'R':
+			ringmode = 1;
+			break;
+
+		case 'F':
+			printframe_fullxl();
+			break;
+
+		case 'w':
+			capname = optarg;
+			break;
+
+		case 'z':
+			comp = 1;
+			break;
+
 		case '?':
 		case 'h':
 		default:
@@ -92,6 +755,46 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	/* -Q does not process the frames any further */
+	if (capname && seqmode) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
+	/* the latency needs the software rx timestamp on the host clock */
+	if (seqmode)
+		hwstamp = 0;
+
+	/* stdout is flushed by size/time and before waiting for frames */
+	printframe_setbuf();
+
+	if (capname) {
+		if (strcmp(capname, "-")) {
+			capf = fopen(capname, "w");
+			if (!capf) {
+				perror(capname);
+				return 1;
+			}
+		}
+
+		if (xlcap_create(&capw, capf, comp) < 0) {
+			perror("capture");
+			return 1;
+		}
+		capture = 1;
+	}
+
+	if (ringmode) {
+		/* print the statistics on SIGINT/SIGTERM */
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+
+		ret = ring_capture(argv[optind], seqmode, vcid, &vcid_opts);
+		if (capture && finish_capture())
+			return 1;
+		return ret;
+	}
+
 	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
 	if (s < 0) {
 		perror("socket");
@@ -129,72 +832,104 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	while (1) {
-		socklen_t len = sizeof(addr);
+	/* timestamps as control messages instead of SIOCGSTAMP */
+	if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING,
+		       &tsflags, sizeof(tsflags)) < 0 &&
+	    setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS,
+		       &sockopt, sizeof(sockopt)) < 0) {
+		perror("setsockopt SO_TIMESTAMPNS");
+		return 1;
+	}
 
-		nbytes = recvfrom(s, &can.xl, sizeof(struct canxl_frame),
-				  0, (struct sockaddr*)&addr, &len);
-		if (nbytes < 0) {
-			perror("read");
-			return 1;
-		}
-		
-		if (ioctl(s, SIOCGSTAMP, &tv) < 0) {
-			perror("SIOCGSTAMP");
-			return 1;
-		} else {
-			printf("(%ld.%06ld) ", tv.tv_sec, tv.tv_usec);
-		}
+	/* interface names are cached - the cache follows link changes */
+	nl = open_rtnl();
 
-		ifr.ifr_ifindex = addr.can_ifindex;
-		if (ioctl(s, SIOCGIFNAME, &ifr) < 0) {
-			perror("SIOCGIFNAME");
-			return 1;
-		} else {
-			if (max_devname_len < (int)strlen(ifr.ifr_name))
-				max_devname_len = strlen(ifr.ifr_name);
-			printf("%*s ", max_devname_len, ifr.ifr_name);
-		}
+	for (i = 0; i < MAX_BATCH; i++) {
+		rxiov[i].iov_base = &rxbuf[i];
+		rxiov[i].iov_len = sizeof(rxbuf[i]);
+		rxmsg[i].msg_hdr.msg_iov = &rxiov[i];
+		rxmsg[i].msg_hdr.msg_iovlen = 1;
+		rxmsg[i].msg_hdr.msg_name = &rxaddr[i];
+	}
 
-		if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
-			fprintf(stderr, "read: no CAN frame\n");
-			return 1;
+	pfd[0].fd = s;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = nl;
+	pfd[1].events = POLLIN;
+
+	/*
+	 * interrupt the blocking poll() to print the statistics, complete
+	 * the capture or flush the buffered stdout before exit
+	 */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (running) {
+		for (i = 0; i < MAX_BATCH; i++) {
+			rxmsg[i].msg_hdr.msg_namelen = sizeof(rxaddr[i]);
+			rxmsg[i].msg_hdr.msg_control = rxctrl[i];
+			rxmsg[i].msg_hdr.msg_controllen = sizeof(rxctrl[i]);
 		}
 
-		if (can.xl.flags & CANXL_XLF) {
-			if (nbytes != CANXL_HDR_SIZE + can.xl.len) {
-				printf("nbytes = %d\n", nbytes);
-				fprintf(stderr, "read: no CAN XL frame\n");
+		n = recvmmsg(s, rxmsg, MAX_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0 && errno == EAGAIN) {
+			/* idle: wait for CAN frames or link notifications */
+			if (poll(pfd, (nl < 0) ? 1 : 2, rx_idle()) < 0 &&
+			    errno != EINTR) {
+				perror("poll");
 				return 1;
 			}
-
-			if (check_pattern) {
-				for (i = 0; i < can.xl.len; i++) {
-					if (can.xl.data[i] != ((can.xl.len + i) & 0xFFU)) {
-						fprintf(stderr, "check pattern failed %02X %04X\n",
-							can.xl.data[i], can.xl.len + i);
-						return 1;
-					}
-				}
-			}
-			printxlframe(&can.xl);
+			if (nl >= 0 && pfd[1].revents)
+				ifcache_update(nl);
 			continue;
 		}
-
-		if (nbytes == CANFD_MTU) {
-			printfdframe(&can.fd);
+		if (n < 0 && errno == EINTR)
 			continue;
+		if (n < 0) {
+			perror("read");
+			return 1;
 		}
 
-		if (nbytes == CAN_MTU) {
-			printccframe(&can.cc);
+		if (nl >= 0 && !(++batches % RTNL_CHECK))
+			ifcache_update(nl);
+
+		if (seqmode) {
+			/* per frame rx timestamp like the ring mode */
+			rtoff = xlseq_rtoff();
+			for (i = 0; i < n; i++) {
+				nbytes = rxmsg[i].msg_len;
+				if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN ||
+				    !(rxbuf[i].xl.flags & CANXL_XLF) ||
+				    nbytes != CANXL_HDR_SIZE + rxbuf[i].xl.len)
+					continue;
+
+				rx_stamp(&rxmsg[i].msg_hdr, &ts);
+				if (ts.tv_sec || ts.tv_nsec)
+					rxts = ts.tv_sec * 1000000000ULL +
+						ts.tv_nsec - rtoff;
+				else
+					rxts = xlseq_now();
+				seq_frame(&rxbuf[i].xl, rxts);
+			}
 			continue;
 		}
 
-		fprintf(stderr, "read: incomplete CAN(FD) frame\n");
-		return 1;
+		for (i = 0; i < n; i++) {
+			rx_stamp(&rxmsg[i].msg_hdr, &ts);
+			if (rx_frame(&rxbuf[i], rxmsg[i].msg_len, &ts,
+				     rxaddr[i].can_ifindex))
+				return 1;
+		}
 	}
 
+	if (seqmode)
+		print_seqstats();
+
+	if (capture && finish_capture())
+		return 1;
+
+	if (nl >= 0)
+		close(nl);
 	close(s);
 
 	return 0;
@@ -0,0 +1,393 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * canxlreplay.c - replay candump logs with CAN CC/FD/XL frames
+ *
+ * The log is mapped with canlog.h and parsed while sending. Frames are
+ * sent with the original inter-frame gaps (optionally scaled by a
+ * speed factor), with an equidistant gap or as fast as possible. Due
+ * frames for the same interface are sent in sendmmsg() batches.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "canlog.h"
+
+#define DEFAULT_BATCH 32
+#define MAX_BATCH 64
+#define MAX_IFS 16
+
+extern int optind, opterr, optopt;
+
+/* <write-if>=<log-if> interface assignments */
+struct replay_if {
+	char logif[IFNAMSIZ];
+	char txif[IFNAMSIZ];
+	int s;
+};
+
+static struct replay_if ifs[MAX_IFS];
+static unsigned int nifs;
+static int assigned; /* only replay assigned interfaces */
+
+/* sendmmsg() batch of parsed log frames for one interface */
+static struct canlog_frame txframe[MAX_BATCH];
+static struct iovec txiov[MAX_BATCH];
+static struct mmsghdr txmsg[MAX_BATCH];
+
+/* statistics */
+static unsigned long long frames, skipped;
+static volatile sig_atomic_t running = 1;
+
+static void sigterm(int signo)
+{
+	running = 0;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) &&
+	       running)
+		;
+}
+
+/* open a socket for CAN CC/FD/XL frames which passes the VCID content */
+static int open_socket(const char *ifname)
+{
+	struct can_raw_vcid_options vcid_opts = {
+		.flags = CAN_RAW_XL_VCID_TX_PASS,
+	};
+	struct sockaddr_can addr;
+	int sockopt = 1;
+	int s;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(ifname);
+	if (!addr.can_ifindex) {
+		perror(ifname);
+		exit(1);
+	}
+
+	/* no receive path needed */
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0) {
+		perror("sockopt CAN_RAW_FILTER");
+		exit(1);
+	}
+
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES,
+		       &sockopt, sizeof(sockopt)) < 0) {
+		perror("sockopt CAN_RAW_FD_FRAMES");
+		exit(1);
+	}
+
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+		       &sockopt, sizeof(sockopt)) < 0) {
+		perror("sockopt CAN_RAW_XL_FRAMES");
+		exit(1);
+	}
+
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
+		       &vcid_opts, sizeof(vcid_opts)) < 0) {
+		perror("sockopt CAN_RAW_XL_VCID_OPTS");
+		exit(1);
+	}
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	return s;
+}
+
+/* returns the assignment of the log interface or NULL to skip the frame */
+static struct replay_if *lookup_if(const char *logif)
+{
+	unsigned int i;
+
+	for (i = 0; i < nifs; i++)
+		if (!strcmp(ifs[i].logif, logif))
+			return &ifs[i];
+
+	if (assigned || nifs == MAX_IFS)
+		return NULL;
+
+	/* send on the interface name from the log */
+	strcpy(ifs[nifs].logif, logif);
+	strcpy(ifs[nifs].txif, logif);
+	ifs[nifs].s = -1;
+
+	return &ifs[nifs++];
+}
+
+static void flush(struct replay_if *m, unsigned int n, int verbose)
+{
+	unsigned int i, sent;
+	int ret;
+
+	if (m->s < 0)
+		m->s = open_socket(m->txif);
+
+	for (sent = 0; sent < n; sent += ret) {
+		ret = sendmmsg(m->s, &txmsg[sent], n - sent, 0);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret < 0) {
+			perror("sendmmsg");
+			exit(1);
+		}
+	}
+	frames += n;
+
+	if (verbose)
+		for (i = 0; i < n; i++)
+			canlog_fprint(stdout, &txframe[i].tv, m->txif,
+				      &txframe[i].cc, txframe[i].mtu);
+}
+
+static inline unsigned long long tv_ns(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "%s - replay candump logs with CAN CC/FD/XL frames\n\n", prg);
+	fprintf(stderr, "Usage: %s [options] <logfile> [<write-if>=<log-if>]*\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -s <factor>    (speed factor - default: 1.0)\n");
+	fprintf(stderr, "         -g <ms>        (equidistant gap instead of the "
+		"log timestamps)\n");
+	fprintf(stderr, "         -t             (ignore timestamps - send as "
+		"fast as possible)\n");
+	fprintf(stderr, "         -b <batch>     (frames per sendmmsg "
+		"- default: %d, max %d)\n", DEFAULT_BATCH, MAX_BATCH);
+	fprintf(stderr, "         -l <loops>     (replay the log <loops> times "
+		"- default: 1, 0: endless)\n");
+	fprintf(stderr, "         -v             (verbose)\n");
+	fprintf(stderr, "\nWithout interface assignments the frames are sent on "
+		"the interfaces from the log.\n");
+	fprintf(stderr, "With assignments (e.g. vcanxl0=can0) only the assigned "
+		"interfaces are replayed.\n");
+	fprintf(stderr, "Statistics are printed to stderr at the end or on "
+		"SIGINT/SIGTERM.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	double speed = 1.0;
+	double gap = -1; /* ms - < 0 => log timestamps */
+	int nowait = 0;
+	unsigned int batch = DEFAULT_BATCH;
+	unsigned int loops = 1;
+	int verbose = 0;
+
+	struct sigaction sa = { .sa_handler = sigterm };
+	struct canlog log;
+	struct replay_if *m, *bm = NULL;
+	unsigned long long start, ts, first = 0, t = 0, base = 0;
+	unsigned long long nframes = 0, lframes;
+	unsigned int n = 0, i;
+	int mtu, loop;
+	char *eq;
+
+	while ((opt = getopt(argc, argv, "s:g:tb:l:vh?")) != -1) {
+		switch (opt) {
+
+		case 's':
+			speed = strtod(optarg, NULL);
+			if (speed <= 0) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'g':
+			gap = strtod(optarg, NULL);
+			if (gap < 0) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 't':
+			nowait = 1;
+			break;
+
+		case 'b':
+			batch = strtoul(optarg, NULL, 10);
+			if (batch < 1 || batch > MAX_BATCH) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'l':
+			loops = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	if (optind == argc) {
+		print_usage(basename(argv[0]));
+		exit(0);
+	}
+
+	/* <write-if>=<log-if> interface assignments */
+	for (i = optind + 1; i < (unsigned int)argc; i++) {
+		eq = strchr(argv[i], '=');
+		if (!eq || eq == argv[i] || eq - argv[i] >= IFNAMSIZ ||
+		    strlen(eq + 1) < 1 || strlen(eq + 1) >= IFNAMSIZ ||
+		    nifs == MAX_IFS) {
+			print_usage(basename(argv[0]));
+			return 1;
+		}
+		memcpy(ifs[nifs].txif, argv[i], eq - argv[i]);
+		strcpy(ifs[nifs].logif, eq + 1);
+		ifs[nifs].s = -1;
+		nifs++;
+	}
+	assigned = nifs;
+
+	if (canlog_open(&log, argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	for (i = 0; i < MAX_BATCH; i++) {
+		txmsg[i].msg_hdr.msg_iov = &txiov[i];
+		txmsg[i].msg_hdr.msg_iovlen = 1;
+		txiov[i].iov_base = &txframe[i].cc;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	start = now_ns();
+
+	for (loop = 0; running && (!loops || loop < (int)loops); loop++) {
+		canlog_rewind(&log);
+		lframes = 0;
+
+		while (running) {
+			mtu = canlog_read(&log, &txframe[n]);
+			if (!mtu)
+				break; /* end of log */
+
+			if (mtu < 0) {
+				fprintf(stderr, "%s: malformed line %u skipped\n",
+					argv[optind], log.line);
+				skipped++;
+				continue;
+			}
+
+			m = lookup_if(txframe[n].ifname);
+			if (!m) {
+				skipped++;
+				continue;
+			}
+
+			/* time offset of this frame from the replay start */
+			ts = tv_ns(&txframe[n].tv);
+			if (!lframes++)
+				first = ts;
+			if (gap >= 0)
+				t = nframes * gap * 1000000;
+			else
+				t = base + (ts > first ? (ts - first) / speed : 0);
+			nframes++;
+
+			/* flush when the interface changes or the frame is not due */
+			if (n && (m != bm || (!nowait && start + t > now_ns()))) {
+				flush(bm, n, verbose);
+				memcpy(&txframe[0], &txframe[n], sizeof(txframe[0]));
+				n = 0;
+			}
+
+			if (!n && !nowait)
+				sleep_until(start + t);
+
+			if (txframe[n].mtu == CANXL_MTU)
+				txiov[n].iov_len = CANXL_HDR_SIZE + txframe[n].xl.len;
+			else
+				txiov[n].iov_len = txframe[n].mtu;
+
+			bm = m;
+			if (++n == batch) {
+				flush(bm, n, verbose);
+				n = 0;
+			}
+		}
+
+		/* continue the next loop behind the last frame */
+		base = t;
+	}
+
+	if (n)
+		flush(bm, n, verbose);
+
+	t = now_ns() - start;
+	if (!t)
+		t = 1;
+
+	fprintf(stderr, "replayed %llu frames in %.3f s (%.0f frames/s)",
+		frames, t / 1e9, frames * 1e9 / t);
+	if (skipped)
+		fprintf(stderr, " - %llu skipped", skipped);
+	fprintf(stderr, "\n");
+
+	canlog_close(&log);
+
+	for (i = 0; i < nifs; i++)
+		if (ifs[i].s >= 0)
+			close(ifs[i].s);
+
+	return 0;
+}
@@ -15,7 +15,9 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <signal.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -26,12 +28,12 @@
 #include <linux/sockios.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
-#include "cia-613-3.h"
+#include "libcia613.h"
 #include "printframe.h"
+#include "canlog.h"
 
 #define DEFAULT_MAXBUFFS 3
 #define DEFAULT_MAXLPCNT 2
-#define NO_FCNT_VALUE 0x0FFF0000U
 #define BUFMEMSZ 16 /* for 15 TIDs + invalid index */
 #define TESTDATA_PRIO_BASE 0x400
 #define DEBUG_ID_PRIO_BASE 0x200 /* Bosch 0x100, VW 0x200, Vector 0x300 */
@@ -40,6 +42,24 @@
 
 extern int optind, opterr, optopt;
 
+static volatile sig_atomic_t running = 1;
+
+/* number of sent notifications per TID and notification number */
+static unsigned long nncount[TID_MAX + 1][256];
+static unsigned long long frames;
+
+/* notification numbers listed in the summary report */
+static const unsigned char nnlist[] = {
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+	0x0C, 0x0D, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9,
+};
+#define NNLIST_LEN (sizeof(nnlist) / sizeof(nnlist[0]))
+
+static void sigterm(int signo)
+{
+	running = 0;
+}
+
  /* 15 buffers for 64 possible TID lower bits
   * zero -> no valid TID from plugfest testcases.
   * Therefore index 0 of the 16 buffers is unused.
@@ -62,7 +82,12 @@ void print_usage(char *prg)
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "         -b <maxbuffs>        (default: %d)\n", DEFAULT_MAXBUFFS);
 	fprintf(stderr, "         -l <maxLowPrioCount> (default: %d)\n", DEFAULT_MAXLPCNT);
+	fprintf(stderr, "         -r <logfile>         (read <canxl_if> frames from candump log)\n");
+	fprintf(stderr, "         -s                   (print per TID summary report to stderr)\n");
 	fprintf(stderr, "         -v                   (verbose)\n");
+	fprintf(stderr, "\nWith -r the log is processed at maximum speed without sending\n"
+		"the state frames. Use 'any' as <canxl_if> for all interfaces.\n");
+	fprintf(stderr, "The summary report is printed at the end of the log or on SIGINT/SIGTERM.\n");
 }
 
 void sendstate(int can_if, unsigned int tid, unsigned int nn,
@@ -81,6 +106,12 @@ void sendstate(int can_if, unsigned int tid, unsigned int nn,
 	state.data[1] = ubuffs;
 	state.data[2] = lpcnt;
 
+	nncount[tid & TID_MASK][nn & 0xFF]++;
+
+	/* offline log mode */
+	if (can_if < 0)
+		return;
+
 	nbytes = write(can_if, &state, CANXL_HDR_SIZE + state.len);
 	if (nbytes == CANXL_HDR_SIZE + state.len)
 		return;
@@ -90,6 +121,128 @@ void sendstate(int can_if, unsigned int tid, unsigned int nn,
 	exit(1);
 }
 
+/* filter prio for 0x000 - 0x03F and 0x400 - 0x43F */
+static const struct can_filter rfilter = {
+	.can_id = 0,
+	.can_mask = (CAN_EFF_FLAG | CAN_RTR_FLAG | CANXL_PRIO_MASK) - TESTDATA_PRIO_BASE - TID_MASK,
+};
+
+/*
+ * read the next frame of can_if from the log into cf (like read())
+ *
+ * returns the frame size, 0 at the end of the log or -1 on error
+ */
+int read_log(struct canlog *log, const char *ifname, struct canxl_frame *cf,
+	     struct canlog_frame *lf)
+{
+	int mtu;
+
+	while ((mtu = canlog_read(log, lf)) > 0) {
+		if (strcmp(ifname, "any") && strcmp(ifname, lf->ifname))
+			continue;
+
+		/* apply the CAN_RAW_FILTER of the can_if socket */
+		if ((lf->cc.can_id & rfilter.can_mask) != rfilter.can_id)
+			continue;
+
+		if (mtu == CANXL_MTU) {
+			memcpy(cf, &lf->xl, CANXL_HDR_SIZE + lf->xl.len);
+			return CANXL_HDR_SIZE + lf->xl.len;
+		}
+
+		memcpy(cf, &lf->cc, mtu);
+		return mtu;
+	}
+
+	if (mtu < 0)
+		fprintf(stderr, "log: malformed line %u\n", log->line);
+
+	return mtu;
+}
+
+/* print the notification counts of all TIDs that got a notification */
+void print_summary(void)
+{
+	unsigned long tidsum, sum[NNLIST_LEN] = {0};
+	unsigned long long total = 0;
+	unsigned int tid, i;
+
+	fprintf(stderr, "\nframes: %llu\n\nTID ", frames);
+	for (i = 0; i < NNLIST_LEN; i++)
+		fprintf(stderr, "     %02X", nnlist[i]);
+	fprintf(stderr, "  %8s\n", "total");
+
+	for (tid = 0; tid <= TID_MAX; tid++) {
+		tidsum = 0;
+		for (i = 0; i < NNLIST_LEN; i++)
+			tidsum += nncount[tid][nnlist[i]];
+
+		if (!tidsum)
+			continue;
+
+		fprintf(stderr, " %02X ", tid);
+		for (i = 0; i < NNLIST_LEN; i++) {
+			fprintf(stderr, " %6lu", nncount[tid][nnlist[i]]);
+			sum[i] += nncount[tid][nnlist[i]];
+		}
+		fprintf(stderr, "  %8lu\n", tidsum);
+		total += tidsum;
+	}
+
+	fprintf(stderr, "all ");
+	for (i = 0; i < NNLIST_LEN; i++)
+		fprintf(stderr, " %6lu", sum[i]);
+	fprintf(stderr, "  %8llu\n", total);
+
+	/* nnlist starts with 0x01 .. 0x0D at index nn - 1 */
+	fprintf(stderr, "\nPDUs: %lu correct, %lu incorrect\n",
+		sum[0x03 - 1] + sum[0x0C - 1], sum[0x04 - 1] + sum[0x0D - 1]);
+}
+
+/* open and configure the can_if socket */
+int open_can_if(const char *ifname)
+{
+	int can_if;
+	struct sockaddr_can addr;
+	int sockopt = 1;
+	int ret;
+
+	/* open can_if socket */
+	can_if = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (can_if < 0) {
+		perror("can_if socket");
+		exit(1);
+	}
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(ifname);
+	if (addr.can_ifindex <= 0) {
+		perror("can_if");
+		exit(1);
+	}
+
+	/* enable CAN XL frames */
+	ret = setsockopt(can_if, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+			 &sockopt, sizeof(sockopt));
+	if (ret < 0) {
+		perror("can_if sockopt CAN_RAW_XL_FRAMES");
+		exit(1);
+	}
+
+	ret = setsockopt(can_if, SOL_CAN_RAW, CAN_RAW_FILTER,
+			 &rfilter, sizeof(rfilter));
+	if (ret < 0) {
+		perror("can_if sockopt CAN_RAW_FILTER");
+		exit(1);
+	}
+
+	if (bind(can_if, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	return can_if;
+}
+
 int framecmp(struct canxl_frame *s1, struct canxl_frame *s2)
 {
 	if (s1->len != s2->len)
@@ -102,20 +255,23 @@ int main(int argc, char **argv)
 {
 	int opt;
 	int can_if;
-	struct sockaddr_can addr;
-	struct can_filter rfilter;
 	int i, nbytes, ret;
-	int sockopt = 1;
 	struct timeval tv;
+	char *logname = NULL;
+	struct canlog log;
+	static struct canlog_frame lf;
 
 	unsigned int maxbuffs = DEFAULT_MAXBUFFS;
 	unsigned int maxlpcnt = DEFAULT_MAXLPCNT;
 	unsigned int lpcnt = 0;
 	unsigned int ubuffs = 0;
 	unsigned int verbose = 0;
+	unsigned int summary = 0;
+	struct sigaction sa = { .sa_handler = sigterm };
 
 	unsigned int rxfragsz;
-	unsigned int rxfcnt;
+	unsigned int nextfcnt;
+	int type;
 	struct canxl_frame cf;
 	struct llc_613_3 *llc = (struct llc_613_3 *) cf.data;
 
@@ -124,8 +280,7 @@ int main(int argc, char **argv)
 	unsigned int nn; /* notification number */
 	struct canxl_frame testdata[BUFMEMSZ] = {0};
 	struct canxl_frame pdudata[BUFMEMSZ] = {0};
-	unsigned int dataptr[BUFMEMSZ] = {0};
-	unsigned int fcnt[BUFMEMSZ]; /* init when testdata is received */
+	struct cia613_rx rx[BUFMEMSZ]; /* FCNT and reassembled length */
 
 	/* to search TIDs in pdudata buffer memory */
 	int highest_tid;
@@ -133,7 +288,7 @@ int main(int argc, char **argv)
 	int lowest_tid;
 	int lowest_tid_idx;
 
-	while ((opt = getopt(argc, argv, "b:l:vh?")) != -1) {
+	while ((opt = getopt(argc, argv, "b:l:r:svh?")) != -1) {
 		switch (opt) {
 
 		case 'b':
@@ -152,6 +307,14 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'r':
+			logname = optarg;
+			break;
+
+		case 's':
+			summary = 1;
+			break;
+
 		case 'v':
 			verbose = 1;
 			break;
@@ -178,50 +341,43 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	/* open can_if socket */
-	can_if = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-	if (can_if < 0) {
-		perror("can_if socket");
-		return 1;
-	}
-	addr.can_family = AF_CAN;
-	addr.can_ifindex = if_nametoindex(argv[optind]);
-	if (addr.can_ifindex <= 0) {
-		perror("can_if");
-		exit(1);
-	}
-
-	/* enable CAN XL frames */
-	ret = setsockopt(can_if, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
-			 &sockopt, sizeof(sockopt));
-	if (ret < 0) {
-		perror("can_if sockopt CAN_RAW_XL_FRAMES");
-		exit(1);
+	if (logname) {
+		if (canlog_open(&log, logname) < 0) {
+			perror(logname);
+			return 1;
+		}
+		can_if = -1;
+	} else {
+		can_if = open_can_if(argv[optind]);
 	}
 
-	/* filter prio for 0x000 - 0x03F and 0x400 - 0x43F */
-	rfilter.can_id = 0;
-	rfilter.can_mask = (CAN_EFF_FLAG | CAN_RTR_FLAG | CANXL_PRIO_MASK) - TESTDATA_PRIO_BASE - TID_MASK;
-	ret = setsockopt(can_if, SOL_CAN_RAW, CAN_RAW_FILTER,
-			 &rfilter, sizeof(rfilter));
-	if (ret < 0) {
-		perror("can_if sockopt CAN_RAW_FILTER");
-		exit(1);
-	}
+	for (i = 0; i < BUFMEMSZ; i++)
+		join_reset(&rx[i]);
 
-	if (bind(can_if, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
-		return 1;
+	/* interrupt the blocking read() to print the summary report */
+	if (summary) {
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
 	}
 
 	/* main loop */
-	while (1) {
+	while (running) {
 
 		/* read fragmented CAN XL source frame */
-		nbytes = read(can_if, &cf, sizeof(struct canxl_frame));
-		if (nbytes < 0) {
-			perror("read");
-			return 1;
+		if (logname) {
+			nbytes = read_log(&log, argv[optind], &cf, &lf);
+			if (nbytes < 0)
+				return 1;
+			if (!nbytes)
+				break; /* end of log */
+		} else {
+			nbytes = read(can_if, &cf, sizeof(struct canxl_frame));
+			if (nbytes < 0 && errno == EINTR)
+				continue;
+			if (nbytes < 0) {
+				perror("read");
+				return 1;
+			}
 		}
 
 		if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
@@ -240,7 +396,15 @@ int main(int argc, char **argv)
 			continue;
 		}
 
-		if (verbose) {
+		frames++;
+
+		if (verbose && logname) {
+			/* print timestamp and device name from the log */
+			printf("(%ld.%06ld) %s ", lf.tv.tv_sec, lf.tv.tv_usec,
+			       lf.ifname);
+
+			printxlframe(&cf);
+		} else if (verbose) {
 			if (ioctl(can_if, SIOCGSTAMP, &tv) < 0) {
 				perror("SIOCGSTAMP");
 				return 1;
@@ -264,7 +428,7 @@ int main(int argc, char **argv)
 		if (cf.prio & TESTDATA_PRIO_BASE) {
 			cf.prio &= TID_MASK; /* for memcmp testing */
 			testdata[bufidx] = cf;
-			fcnt[bufidx] = NO_FCNT_VALUE;
+			join_reset(&rx[bufidx]);
 
 			nn = 0x01;
 			printf("TID %02X - state %02X: stored PDU test data\n", tid, nn);
@@ -282,9 +446,8 @@ int main(int argc, char **argv)
 		}
 
 		/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
-		if (!((cf.flags & CANXL_SEC) &&
-		      (cf.len >= LLC_613_3_SIZE) &&
-		      ((llc->pci & PCI_AOT_MASK) == CIA_613_3_AOT))) {
+		type = cia613_frame_type(&cf);
+		if (type == CIA613_NOFRAG) {
 			/* no CiA 613-3 fragment frame => just forward frame */
 
 			if (pdudata[bufidx].len) {
@@ -293,7 +456,7 @@ int main(int argc, char **argv)
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 
 				/* Testcase 3: terminate potential ongoing transmission */
-				fcnt[bufidx] = NO_FCNT_VALUE;
+				join_reset(&rx[bufidx]);
 				/* mark buffer as unused */
 				pdudata[bufidx].len = 0;
 				ubuffs--;
@@ -310,7 +473,7 @@ int main(int argc, char **argv)
 			continue; /* wait for next frame */
 		}
 
-		if ((llc->pci & PCI_VX_MASK) != CIA_613_3_VERSION) {
+		if (type == CIA613_BADVER) {
 			nn = 0x05;
 			printf("TID %02X - state %02X: dropped frame due to wrong CiA 613-3 version\n", tid, nn);
 			sendstate(can_if, tid, nn, ubuffs, lpcnt);
@@ -342,20 +505,17 @@ int main(int argc, char **argv)
 			       lowest_tid, nn, lpcnt, maxlpcnt);
 			sendstate(can_if, lowest_tid, nn, ubuffs, lpcnt);
 
-			fcnt[lowest_tid_idx] = NO_FCNT_VALUE;
+			join_reset(&rx[lowest_tid_idx]);
 			/* mark buffer as unused */
 			pdudata[lowest_tid_idx].len = 0;
 			ubuffs--;
 		}
 
-		/* common FCNT reception handling */
-		rxfcnt = ntohs(llc->fcnt); /* read from PCI with byte order */
-
 		/* retrieve real fragment data size from this CAN XL frame */
 		rxfragsz = cf.len - LLC_613_3_SIZE;
 
 		/* check for first frame */
-		if ((llc->pci & PCI_XF_MASK) == PCI_FF) {
+		if (type == CIA613_FF) {
 
 			nn = 0xE4;
 			printf("TID %02X - state %02X: FF: new TID with currently no assigned buffer\n", tid, nn);
@@ -367,41 +527,30 @@ int main(int argc, char **argv)
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 
 				/* Testcase 2: terminate potential ongoing transmission */
-				fcnt[bufidx] = NO_FCNT_VALUE;
+				join_reset(&rx[bufidx]);
 				/* mark buffer as unused */
 				pdudata[bufidx].len = 0;
 				ubuffs--;
 			}
 
-			if (rxfragsz <  MIN_FRAG_SIZE || rxfragsz > MAX_FRAG_SIZE) {
+			ret = cia613_fragsz_check(type, rxfragsz);
+			if (ret == CIA613_E_SIZE) {
 				nn = 0x06;
 				printf("TID %02X - state %02X: FF: dropped LLC frame illegal fragment size\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 				continue;
 			}
 
-			if (rxfragsz % FRAG_STEP_SIZE) {
+			if (ret == CIA613_E_STEP) {
 				nn = 0x07;
 				printf("TID %02X - state %02X: FF: dropped LLC frame illegal fragment step size\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 				continue;
 			}
 
-			/* take current rxfcnt as initial fcnt */
-			fcnt[bufidx] = rxfcnt;
-
-			/* copy CAN XL header w/o data */
-			memcpy(&pdudata[bufidx], &cf, CANXL_HDR_SIZE);
-
-			/* clear SEC bit from our segmentation process */
-			pdudata[bufidx].flags &= ~CANXL_SEC;
-
-			/* restore original SEC bit from DLX (for other AOT) */
-			if (llc->pci & PCI_SECN)
-				pdudata[bufidx].flags |= CANXL_SEC;
-
-			/* 'reassembled' length without the LLC information */
-			pdudata[bufidx].len = rxfragsz;
+			/* take current rxfcnt as initial fcnt and copy the */
+			/* CAN XL header and fragment data w/o LLC information */
+			join_push(&rx[bufidx], &pdudata[bufidx], &cf);
 
 			/* count buffer as used */
 			if (ubuffs >= maxbuffs) {
@@ -416,7 +565,7 @@ int main(int argc, char **argv)
 					/* mark this buffer as unused */
 					pdudata[bufidx].len = 0;
 					/* only FF can set a proper fcnt value */
-					fcnt[bufidx] = NO_FCNT_VALUE;
+					join_reset(&rx[bufidx]);
 					nn = 0xE6;
 					printf("TID %02X - state %02X: FF: dropped LLC frame (buffer full/low prio)\n", tid, nn);
 					sendstate(can_if, tid, nn, ubuffs, lpcnt);
@@ -425,7 +574,7 @@ int main(int argc, char **argv)
 					/* mark grabbed buffer as unused */
 					pdudata[highest_tid_idx].len = 0;
 					/* only FF can set a proper fcnt value */
-					fcnt[highest_tid_idx] = NO_FCNT_VALUE;
+					join_reset(&rx[highest_tid_idx]);
 					nn = 0xE5;
 					printf("TID %02X - state %02X: FF: grabbed buffer from TID %02X\n", tid, nn, highest_tid);
 					sendstate(can_if, highest_tid, nn, ubuffs, lpcnt);
@@ -435,14 +584,6 @@ int main(int argc, char **argv)
 				ubuffs++;
 			}
 
-			/* copy CAN XL fragment data w/o LLC information */
-			memcpy(&pdudata[bufidx].data[0],
-			       &cf.data[LLC_613_3_SIZE],
-			       pdudata[bufidx].len);
-
-			/* update data pointer for next fragment data */
-			dataptr[bufidx] = pdudata[bufidx].len;
-
 			nn = 0x08;
 			printf("TID %02X - state %02X: FF: correctly received first fragment\n", tid, nn);
 			sendstate(can_if, tid, nn, ubuffs, lpcnt);
@@ -450,18 +591,17 @@ int main(int argc, char **argv)
 		} /* FF */
 
 		/* consecutive frame (FF/LF are unset) */
-		if ((llc->pci & PCI_XF_MASK) == 0) {
+		if (type == CIA613_CF) {
 
-			if (fcnt[bufidx] != NO_FCNT_VALUE) {
-				fcnt[bufidx]++;
-				fcnt[bufidx] &= 0xFFFFU;
-			}
+			/* check FCNT, fragment size and append fragment data */
+			nextfcnt = join_next_fcnt(&rx[bufidx]);
+			ret = join_push(&rx[bufidx], &pdudata[bufidx], &cf);
 
 			/* check that rxfcnt has increased */
-			if (fcnt[bufidx] != rxfcnt) {
+			if (ret == CIA613_E_FCNT) {
 				nn = 0xE3;
 				printf("TID %02X - state %02X: CF: abort reception wrong FCNT! (%d/%d)\n",
-				       tid, nn, fcnt[bufidx], rxfcnt);
+				       tid, nn, nextfcnt, ntohs(llc->fcnt));
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 
 				/* Testcase 5: terminate potential ongoing transmission */
@@ -470,19 +610,17 @@ int main(int argc, char **argv)
 					pdudata[bufidx].len = 0;
 					ubuffs--;
 				}
-				/* only FF can set a proper fcnt value */
-				fcnt[bufidx] = NO_FCNT_VALUE;
 				continue;
 			}
 
-			if (rxfragsz <  MIN_FRAG_SIZE || rxfragsz > MAX_FRAG_SIZE) {
+			if (ret == CIA613_E_SIZE) {
 				nn = 0x09;
 				printf("TID %02X - state %02X: CF: dropped LLC frame illegal fragment size\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 				continue;
 			}
 
-			if (rxfragsz % FRAG_STEP_SIZE) {
+			if (ret == CIA613_E_STEP) {
 				nn = 0x0A;
 				printf("TID %02X - state %02X: CF: dropped LLC frame illegal fragment step size\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
@@ -490,38 +628,28 @@ int main(int argc, char **argv)
 			}
 
 			/* make sure the data fits into the unfragmented frame */
-			if (dataptr[bufidx] + rxfragsz > CANXL_MAX_DLEN) {
+			if (ret == CIA613_E_OVERFLOW) {
 				nn = 0xE9;
 				printf("TID %02X - state %02X: CF: dropped CF frame size overflow\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 				continue;
 			}
 
-			/* copy CAN XL fragment data w/o LLC information */
-			memcpy(&pdudata[bufidx].data[dataptr[bufidx]],
-			       &cf.data[LLC_613_3_SIZE],
-			       rxfragsz);
-
-			/* update data pointer and len for next fragment data */
-			dataptr[bufidx] += rxfragsz;
-			pdudata[bufidx].len += rxfragsz;
-
 			continue; /* wait for next frame */
 		} /* CF */
 
 		/* last frame */
-		if ((llc->pci & PCI_XF_MASK) == PCI_LF) {
+		if (type == CIA613_LF) {
 
-			if (fcnt[bufidx] != NO_FCNT_VALUE) {
-				fcnt[bufidx]++;
-				fcnt[bufidx] &= 0xFFFFU;
-			}
+			/* check FCNT, fragment size and append fragment data */
+			nextfcnt = join_next_fcnt(&rx[bufidx]);
+			ret = join_push(&rx[bufidx], &pdudata[bufidx], &cf);
 
 			/* check that rxfcnt has increased */
-			if (fcnt[bufidx] != rxfcnt) {
+			if (ret == CIA613_E_FCNT) {
 				nn = 0xE3;
 				printf("TID %02X - state %02X: LF: abort reception wrong FCNT! (%d/%d)\n",
-				       tid, nn, fcnt[bufidx], rxfcnt);
+				       tid, nn, nextfcnt, ntohs(llc->fcnt));
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 
 				/* mark buffer as unused */
@@ -529,12 +657,10 @@ int main(int argc, char **argv)
 					pdudata[bufidx].len = 0;
 					ubuffs--;
 				}
-				/* only FF can set a proper fcnt value */
-				fcnt[bufidx] = NO_FCNT_VALUE;
 				continue;
 			}
 
-			if (rxfragsz < LF_MIN_FRAG_SIZE || rxfragsz > MAX_FRAG_SIZE) {
+			if (ret == CIA613_E_SIZE) {
 				nn = 0x0B;
 				printf("TID %02X - state %02X: LF: dropped LLC frame illegal fragment size\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
@@ -542,21 +668,13 @@ int main(int argc, char **argv)
 			}
 
 			/* make sure the data fits into the unfragmented frame */
-			if (dataptr[bufidx] + rxfragsz > CANXL_MAX_DLEN) {
+			if (ret == CIA613_E_OVERFLOW) {
 				nn = 0xE9;
 				printf("TID %02X - state %02X: LF: dropped LF frame size overflow\n", tid, nn);
 				sendstate(can_if, tid, nn, ubuffs, lpcnt);
 				continue;
 			}
 
-			/* copy CAN XL fragment data w/o LLC information */
-			memcpy(&pdudata[bufidx].data[dataptr[bufidx]],
-			       &cf.data[LLC_613_3_SIZE],
-			       rxfragsz);
-
-			/* update length value with last frame content size */
-			pdudata[bufidx].len += rxfragsz;
-
 			if (!framecmp(&pdudata[bufidx], &testdata[bufidx])) {
 				nn = 0x0C;
 				printf("TID %02X - state %02X: received correct PDU\n", tid, nn);
@@ -566,8 +684,6 @@ int main(int argc, char **argv)
 			}
 			sendstate(can_if, tid, nn, ubuffs, lpcnt);
 
-			/* only FF can set a proper fcnt value */
-			fcnt[bufidx] = NO_FCNT_VALUE;
 			/* mark buffer as unused */
 			pdudata[bufidx].len = 0;
 			ubuffs--;
@@ -581,9 +697,15 @@ int main(int argc, char **argv)
 		sendstate(can_if, tid, nn, ubuffs, lpcnt);
 		continue; /* wait for next frame */
 
-	} /* while(1) */
+	} /* while (running) */
+
+	if (summary)
+		print_summary();
 
-	close(can_if);
+	if (logname)
+		canlog_close(&log);
+	else
+		close(can_if);
 
 	return 0;
 }
@@ -9,11 +9,16 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <errno.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <net/if.h>
 #include <arpa/inet.h> /* for network byte order conversion */
 
@@ -21,12 +26,677 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include "cia-613-3.h"
+#include "libcia613.h"
 #include "printframe.h"
+#include "xlring.h"
+#include "xllog.h"
 
 #define DEFAULT_TRANSFER_ID 0x242
+#define MAX_FRAGS CIA613_MAX_FRAGS
+#define MAX_TIDS 64 /* max number of configured transfer IDs */
+#define VCID_VALUES (CANXL_VCID_VAL_MASK + 1)
+#define MAX_RING_SLOTS 65536
 
 extern int optind, opterr, optopt;
 
+/* zero-copy fragments: xlfrag_hdr + data slice from the source frame */
+static struct xlfrag_hdr zchdr[MAX_FRAGS];
+static struct iovec zciov[MAX_FRAGS][2];
+static struct mmsghdr zcmsg[MAX_FRAGS];
+
+/*
+ * FCNT counters for each (TID, VCID) tuple of the source frames
+ * tid2idx[] maps the configured transfer IDs to 1 .. ntids
+ */
+static unsigned int tid2idx[CANXL_PRIO_MASK + 1];
+static unsigned int txfcnt[MAX_TIDS + 1][VCID_VALUES];
+
+/* fragment frames of the copying (default) mode */
+static struct canxl_frame cfdst[MAX_FRAGS];
+
+/* verbose output: records of the main thread for the formatter thread */
+static struct xllog xllog;
+static struct xllog_ring *logring;
+
+/* statistics */
+static unsigned long long pdus, frags, fwframes;
+static volatile sig_atomic_t running = 1;
+
+static void sigterm(int signo)
+{
+	running = 0;
+}
+
+/* interrupts a blocking read() of the reader thread */
+static void sigwakeup(int signo)
+{
+}
+
+/* SO_TIMESTAMP rx timestamp from the control message (no ioctl per frame) */
+static void rx_timestamp(struct msghdr *msg, struct timeval *tv)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMP)
+			memcpy(tv, CMSG_DATA(cmsg), sizeof(*tv));
+	}
+}
+
+/*
+ * read and check a source CAN XL frame (with rx timestamp when verbose)
+ *
+ * returns the number of read bytes, 0 when interrupted or -1 on errors
+ */
+static int read_frame(int src, struct canxl_frame *cf, struct timeval *tv,
+		      int verbose)
+{
+	char ctrl[CMSG_SPACE(sizeof(struct timeval))];
+	struct iovec iov = { .iov_base = cf, .iov_len = sizeof(*cf) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	int nbytes;
+
+	if (verbose) {
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+	}
+
+	nbytes = recvmsg(src, &msg, 0);
+	if (nbytes < 0) {
+		if (errno == EINTR)
+			return 0;
+		perror("read");
+		return -1;
+	}
+
+	if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
+		fprintf(stderr, "read: no CAN frame\n");
+		return -1;
+	}
+
+	if (!(cf->flags & CANXL_XLF)) {
+		fprintf(stderr, "read: no CAN XL frame flag\n");
+		return -1;
+	}
+
+	if (nbytes != CANXL_HDR_SIZE + cf->len) {
+		printf("nbytes = %d\n", nbytes);
+		fprintf(stderr, "read: no CAN XL frame len\n");
+		return -1;
+	}
+
+	if (verbose)
+		rx_timestamp(&msg, tv);
+
+	return nbytes;
+}
+
+/*
+ * Reader/writer pipeline
+ *
+ * The reader thread only drains the source socket into the SPSC ring
+ * while the main thread fragments and sends the frames from the ring
+ * slots. So bursts of long PDUs are absorbed by the ring instead of
+ * overflowing the socket receive queue while the fragments are sent.
+ */
+struct reader {
+	pthread_t thread;
+	int src;
+	int verbose;
+	int err; /* read error - main thread terminates with exit code 1 */
+};
+
+static struct xlring xlring;
+
+static void *reader_thread(void *arg)
+{
+	struct reader *rd = arg;
+	struct xlring_slot *slot;
+	int ret;
+
+	while (running) {
+		slot = xlring_prod_wait(&xlring, &running);
+		if (!slot)
+			break;
+
+		ret = read_frame(rd->src, &slot->cf, &slot->tv, rd->verbose);
+		if (ret < 0) {
+			/* regular shutdown with statistics and log output */
+			rd->err = 1;
+			running = 0;
+			xlring_futex_wake(&xlring.head);
+			break;
+		}
+
+		if (ret)
+			xlring_push(&xlring);
+	}
+
+	return NULL;
+}
+
+/* FCNT counter of the (TID, VCID) tuple from the source frame prio */
+static inline unsigned int *fcnt_ctx(canid_t prio)
+{
+	return &txfcnt[tid2idx[prio & CANXL_PRIO_MASK]]
+		[(prio & CANXL_VCID_MASK) >> CANXL_VCID_OFFSET];
+}
+
+/*
+ * build the CAN XL header + LLC information for all fragments of cf and
+ * point the second iovec of each fragment to its data slice inside cf
+ *
+ * returns the number of fragments
+ */
+static unsigned int build_zcfrags(struct canxl_frame *cf, unsigned int fragsz,
+				  unsigned int *txfcnt,
+				  struct xlfrag_hdr *hdr, struct iovec (*iov)[2])
+{
+	unsigned int nfrags, i;
+
+	/* fragment size specific kernel */
+	nfrags = frag_pdu_hdr(cf, fragsz, txfcnt, hdr);
+
+	/* data slices in the source frame */
+	for (i = 0; i < nfrags; i++) {
+		iov[i][1].iov_base = &cf->data[i * fragsz];
+		iov[i][1].iov_len = hdr[i].len - LLC_613_3_SIZE;
+	}
+
+	return nfrags;
+}
+
+/* log the fragments of build_zcfrags() */
+static void log_zcfrags(struct xlfrag_hdr *hdr, struct iovec (*iov)[2],
+			unsigned int nfrags)
+{
+	struct xllog_rec *rec;
+	__u64 ts = xllog_now();
+	unsigned int len, i;
+
+	for (i = 0; i < nfrags; i++) {
+		rec = xllog_rec(logring);
+		if (!rec)
+			continue;
+
+		rec->ts = ts;
+		rec->type = XLLOG_TX;
+		rec->flags = 0;
+
+		/* CAN XL header + LLC and the start of the data slice */
+		memcpy(&rec->prio, &hdr[i], sizeof(struct xlfrag_hdr));
+		len = iov[i][1].iov_len;
+		if (len > XLLOG_DATA - LLC_613_3_SIZE)
+			len = XLLOG_DATA - LLC_613_3_SIZE;
+		memcpy(&rec->data[LLC_613_3_SIZE], iov[i][1].iov_base, len);
+		xllog_push(logring);
+	}
+}
+
+/*
+ * Priority-preemptive fragment scheduler
+ *
+ * Received source frames are queued per TID. After each fragment the
+ * source socket is checked for new frames and the next fragment is
+ * taken from the TID with the highest CAN XL priority (lowest prio
+ * value). The configured TIDs are sorted by prio, so the lowest bit
+ * in schedmap (bit n => TID index n + 1) is the next TID to serve.
+ */
+#define SCHED_SLOTS 64
+
+struct schedtid {
+	unsigned short slot[SCHED_SLOTS]; /* FIFO of source frame slots */
+	unsigned int head, cnt;
+	unsigned int nfrags; /* fragments of the current source frame */
+	unsigned int nextfrag; /* 0 => current frame not started yet */
+	struct xlfrag_hdr hdr[MAX_FRAGS];
+	struct iovec iov[MAX_FRAGS][2];
+};
+
+static struct schedtid schedtid[MAX_TIDS + 1];
+static struct canxl_frame schedbuf[SCHED_SLOTS];
+static unsigned short schedfree[SCHED_SLOTS];
+static unsigned int nschedfree;
+static unsigned long long schedmap;
+
+/* send the next fragment (or forwarded frame) of the TID at tididx */
+static void sched_send(int dst, unsigned int tididx, unsigned int fragsz,
+		       int verbose)
+{
+	struct schedtid *st = &schedtid[tididx];
+	unsigned short slot = st->slot[st->head];
+	struct canxl_frame *cf = &schedbuf[slot];
+	struct msghdr msg = { .msg_iovlen = 2 };
+	unsigned int len;
+	int nbytes;
+
+	if (cf->len <= fragsz) {
+		/* just forward the unsegmented src frame */
+		nbytes = write(dst, cf, CANXL_HDR_SIZE + cf->len);
+		if (nbytes != CANXL_HDR_SIZE + cf->len) {
+			printf("nbytes = %d\n", nbytes);
+			perror("forward src canxl_frame");
+			exit(1);
+		}
+		fwframes++;
+
+		if (verbose)
+			xllog_frame(logring, XLLOG_FW, 0,
+				    xllog_now(), cf);
+		st->nfrags = 0;
+	} else {
+		if (!st->nextfrag) {
+			st->nfrags = build_zcfrags(cf, fragsz, fcnt_ctx(cf->prio),
+						   st->hdr, st->iov);
+			pdus++;
+		}
+
+		msg.msg_iov = st->iov[st->nextfrag];
+		len = CANXL_HDR_SIZE + st->hdr[st->nextfrag].len;
+
+		/* write fragment frame */
+		nbytes = sendmsg(dst, &msg, 0);
+		if (nbytes != (int)len) {
+			printf("nbytes = %d\n", nbytes);
+			perror("write dst canxl_frame");
+			exit(1);
+		}
+		frags++;
+
+		if (verbose)
+			log_zcfrags(&st->hdr[st->nextfrag],
+				    &st->iov[st->nextfrag], 1);
+
+		st->nextfrag++;
+	}
+
+	if (st->nextfrag < st->nfrags)
+		return;
+
+	/* source frame completed => release slot */
+	st->nextfrag = 0;
+	schedfree[nschedfree++] = slot;
+	st->head = (st->head + 1) % SCHED_SLOTS;
+	if (!--st->cnt)
+		schedmap &= ~(1ULL << (tididx - 1));
+}
+
+static int sched_frag(int src, int dst, unsigned int fragsz, int verbose)
+{
+	char ctrl[CMSG_SPACE(sizeof(struct timeval))];
+	struct iovec iov = { .iov_len = sizeof(struct canxl_frame) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	struct schedtid *st;
+	struct canxl_frame *cf;
+	struct timeval tv;
+	unsigned int tididx;
+	unsigned short slot;
+	unsigned int i, j;
+	int nbytes;
+
+	for (i = 1; i <= MAX_TIDS; i++) {
+		for (j = 0; j < MAX_FRAGS; j++) {
+			schedtid[i].iov[j][0].iov_base = &schedtid[i].hdr[j];
+			schedtid[i].iov[j][0].iov_len = sizeof(struct xlfrag_hdr);
+		}
+	}
+
+	for (nschedfree = 0; nschedfree < SCHED_SLOTS; nschedfree++)
+		schedfree[nschedfree] = nschedfree;
+
+	while (running) {
+
+		/* intake: only block when there is nothing to send */
+		while (nschedfree) {
+			slot = schedfree[nschedfree - 1];
+			cf = &schedbuf[slot];
+
+			iov.iov_base = cf;
+			if (verbose) {
+				msg.msg_control = ctrl;
+				msg.msg_controllen = sizeof(ctrl);
+			}
+
+			nbytes = recvmsg(src, &msg, schedmap ? MSG_DONTWAIT : 0);
+			if (nbytes < 0) {
+				if (errno == EAGAIN || errno == EINTR)
+					break;
+				perror("read");
+				return 1;
+			}
+
+			if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
+				fprintf(stderr, "read: no CAN frame\n");
+				return 1;
+			}
+
+			if (!(cf->flags & CANXL_XLF)) {
+				fprintf(stderr, "read: no CAN XL frame flag\n");
+				return 1;
+			}
+
+			if (nbytes != CANXL_HDR_SIZE + cf->len) {
+				printf("nbytes = %d\n", nbytes);
+				fprintf(stderr, "read: no CAN XL frame len\n");
+				return 1;
+			}
+
+			if (verbose) {
+				rx_timestamp(&msg, &tv);
+				xllog_frame(logring, XLLOG_RX, XLLOG_F_START,
+					    xllog_tv(&tv), cf);
+			}
+
+			/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
+			if (cia613_frame_type(cf) != CIA613_NOFRAG) {
+
+				/* 613-3 inside 613-3 fragmentation is not allowed */
+				xllog_msg(logring, XLLOG_M_TUNNEL, 0, 0, 0);
+				continue;
+			}
+
+			tididx = tid2idx[cf->prio & CANXL_PRIO_MASK];
+			if (!tididx)
+				continue;
+
+			/* enqueue source frame for its TID */
+			nschedfree--;
+			st = &schedtid[tididx];
+			st->slot[(st->head + st->cnt++) % SCHED_SLOTS] = slot;
+			schedmap |= 1ULL << (tididx - 1);
+		}
+
+		/* emission: one fragment of the highest priority TID */
+		if (schedmap)
+			sched_send(dst, __builtin_ctzll(schedmap) + 1, fragsz,
+				   verbose);
+	}
+
+	return 0;
+}
+
+static int tidcmp(const void *a, const void *b)
+{
+	return *(const canid_t *)a - *(const canid_t *)b;
+}
+
+#ifdef USE_IO_URING
+#include "uring.h"
+
+#define URING_ENTRIES 256
+#define URING_BUFS 64 /* power of 2 */
+#define URING_BGID 0
+
+/* user_data: buffer id, fragment index and flags */
+#define UD_BID_MASK	0xFFFFULL
+#define UD_FRAG_SHIFT	16
+#define UD_FRAG_MASK	0xFFULL
+#define UD_RECV		(1ULL << 32)
+#define UD_FORWARD	(1ULL << 33)
+#define UD_LASTBUF	(1ULL << 34) /* last send from this rx buffer */
+#define UD_LASTCHAIN	(1ULL << 35) /* last send of the linked chain */
+
+static struct uring ring;
+static struct uring_bufring bufring;
+static struct canxl_frame ubuf[URING_BUFS];
+static struct xlfrag_hdr uhdr[URING_BUFS][MAX_FRAGS];
+static struct iovec uiov[URING_BUFS][MAX_FRAGS][2];
+static struct msghdr umsg[URING_BUFS][MAX_FRAGS];
+
+/* received source frames waiting for transmission (in rx order) */
+static unsigned short pendq[URING_BUFS];
+static unsigned int pendhead, npend;
+
+static int uring_arm_recv(int src)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+
+	if (!sqe)
+		return 0;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = src;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = UD_RECV;
+
+	return 1;
+}
+
+static void uring_recycle(unsigned short bid)
+{
+	uring_buf_add(&bufring, &ubuf[bid], sizeof(struct canxl_frame), bid);
+}
+
+/*
+ * Submit all fragments (and forwarded frames) of the pending source
+ * frames as one chain of linked SQEs. Only one chain is in flight at a
+ * time to keep the FCNT order on the wire when sends are deferred.
+ */
+static int uring_queue_chain(int dst, unsigned int fragsz, int verbose)
+{
+	struct io_uring_sqe *sqe = NULL;
+	struct canxl_frame *cf;
+	unsigned short bid;
+	unsigned int nfrags, i;
+
+	while (npend && uring_sq_space(&ring) >= MAX_FRAGS) {
+		bid = pendq[pendhead];
+		pendhead = (pendhead + 1) % URING_BUFS;
+		npend--;
+		cf = &ubuf[bid];
+
+		if (cf->len <= fragsz) {
+			/* just forward the unsegmented src frame */
+			sqe = uring_get_sqe(&ring);
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = dst;
+			sqe->addr = (unsigned long)cf;
+			sqe->len = CANXL_HDR_SIZE + cf->len;
+			sqe->flags = IOSQE_IO_LINK;
+			sqe->user_data = bid | UD_FORWARD | UD_LASTBUF;
+			fwframes++;
+
+			if (verbose)
+				xllog_frame(logring, XLLOG_FW, 0,
+					    xllog_now(), cf);
+			continue;
+		}
+
+		nfrags = build_zcfrags(cf, fragsz, fcnt_ctx(cf->prio),
+				       uhdr[bid], uiov[bid]);
+
+		for (i = 0; i < nfrags; i++) {
+			sqe = uring_get_sqe(&ring);
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = dst;
+			sqe->addr = (unsigned long)&umsg[bid][i];
+			sqe->len = 1;
+			sqe->flags = IOSQE_IO_LINK;
+			sqe->user_data = bid | (unsigned long long)i << UD_FRAG_SHIFT;
+		}
+		sqe->user_data |= UD_LASTBUF;
+
+		pdus++;
+		frags += nfrags;
+
+		if (verbose)
+			log_zcfrags(uhdr[bid], uiov[bid], nfrags);
+	}
+
+	if (!sqe)
+		return 0;
+
+	/* terminate the chain */
+	sqe->flags &= ~IOSQE_IO_LINK;
+	sqe->user_data |= UD_LASTCHAIN;
+
+	return 1;
+}
+
+/*
+ * io_uring engine: multishot receive into a provided buffer ring and
+ * zero-copy linked sends of the fragments straight out of these buffers
+ *
+ * returns -1 when io_uring is not available (use blocking path instead)
+ */
+static int uring_frag(int src, int dst, unsigned int fragsz, int verbose)
+{
+	struct io_uring_cqe *cqe;
+	struct canxl_frame *cf;
+	unsigned long long ud;
+	unsigned int i, j, expected;
+	unsigned short bid;
+	unsigned int held = 0; /* received buffers not recycled yet */
+	int inflight = 0;
+	int rearm = 1;
+	int ret;
+
+	ret = uring_init(&ring, URING_ENTRIES);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring not available (%s) - "
+			"using blocking I/O\n", strerror(-ret));
+		return -1;
+	}
+
+	ret = uring_bufring_init(&ring, &bufring, URING_BUFS, URING_BGID);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring buffer ring not available (%s) - "
+			"using blocking I/O\n", strerror(-ret));
+		close(ring.fd);
+		return -1;
+	}
+
+	for (i = 0; i < URING_BUFS; i++) {
+		for (j = 0; j < MAX_FRAGS; j++) {
+			uiov[i][j][0].iov_base = &uhdr[i][j];
+			uiov[i][j][0].iov_len = sizeof(struct xlfrag_hdr);
+			umsg[i][j].msg_iov = uiov[i][j];
+			umsg[i][j].msg_iovlen = 2;
+		}
+		uring_recycle(i);
+	}
+
+	printf("using io_uring engine\n");
+
+	while (running) {
+
+		/*
+		 * Without a free buffer the new receive would terminate with
+		 * ENOBUFS right away - wait for the send completions instead.
+		 */
+		if (rearm && held < URING_BUFS)
+			rearm = !uring_arm_recv(src);
+
+		if (!inflight)
+			inflight = uring_queue_chain(dst, fragsz, verbose);
+
+		ret = uring_submit_and_wait(&ring, 1);
+		if (ret < 0) {
+			if (ret == -EINTR)
+				continue;
+			fprintf(stderr, "io_uring_enter: %s\n", strerror(-ret));
+			return 1;
+		}
+
+		while ((cqe = uring_peek_cqe(&ring))) {
+			ud = cqe->user_data;
+			bid = ud & UD_BID_MASK;
+
+			if (ud & UD_RECV) {
+				/* multishot receive terminated? */
+				if (!(cqe->flags & IORING_CQE_F_MORE))
+					rearm = 1;
+
+				if (cqe->res == -ENOBUFS) {
+					/* all buffers in use - rearm after recycling */
+					uring_cqe_seen(&ring);
+					continue;
+				}
+
+				if (cqe->res < 0) {
+					fprintf(stderr, "recv: %s\n",
+						strerror(-cqe->res));
+					return 1;
+				}
+
+				bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				cf = &ubuf[bid];
+				held++;
+
+				if (cqe->res < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
+					fprintf(stderr, "read: no CAN frame\n");
+					return 1;
+				}
+
+				if (!(cf->flags & CANXL_XLF)) {
+					fprintf(stderr, "read: no CAN XL frame flag\n");
+					return 1;
+				}
+
+				if (cqe->res != CANXL_HDR_SIZE + cf->len) {
+					printf("nbytes = %d\n", cqe->res);
+					fprintf(stderr, "read: no CAN XL frame len\n");
+					return 1;
+				}
+
+				uring_cqe_seen(&ring);
+
+				/* no rx timestamp in this mode */
+				if (verbose)
+					xllog_frame(logring, XLLOG_RX, XLLOG_F_START,
+						    xllog_now(), cf);
+
+				/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
+				if (cia613_frame_type(cf) != CIA613_NOFRAG) {
+
+					/* 613-3 inside 613-3 fragmentation is not allowed */
+					xllog_msg(logring, XLLOG_M_TUNNEL, 0, 0, 0);
+					uring_recycle(bid);
+					held--;
+					continue;
+				}
+
+				pendq[(pendhead + npend) % URING_BUFS] = bid;
+				npend++;
+				continue;
+			}
+
+			/* send completion */
+			if (ud & UD_FORWARD)
+				expected = CANXL_HDR_SIZE + ubuf[bid].len;
+			else
+				expected = CANXL_HDR_SIZE +
+					uhdr[bid][(ud >> UD_FRAG_SHIFT) &
+						  UD_FRAG_MASK].len;
+
+			if (cqe->res != (int)expected) {
+				printf("nbytes = %d\n", cqe->res);
+				fprintf(stderr, "send dst canxl_frame: %s\n",
+					cqe->res < 0 ? strerror(-cqe->res) : "");
+				return 1;
+			}
+
+			uring_cqe_seen(&ring);
+
+			if (ud & UD_LASTBUF) {
+				uring_recycle(bid);
+				held--;
+			}
+
+			if (ud & UD_LASTCHAIN)
+				inflight = 0;
+		}
+	}
+
+	close(ring.fd);
+
+	return 0;
+}
+#endif /* USE_IO_URING */
+
 void print_usage(char *prg)
 {
 	fprintf(stderr, "%s - CAN XL CiA 613-3 gateway (fragmentation)\n\n", prg);
@@ -36,37 +706,67 @@ void print_usage(char *prg)
 		"- default: %d bytes)\n", DEFAULT_FRAG_SIZE);
 	fprintf(stderr, "         -t <transfer_id> (TRANSFER ID "
 		"- default: 0x%03X)\n", DEFAULT_TRANSFER_ID);
+	fprintf(stderr, "         -t <tid>,<tid>,... (multiple TRANSFER IDs "
+		"- max %d)\n", MAX_TIDS);
 	fprintf(stderr, "         -V <vcid>        (set virtual CAN network ID)\n");
 	fprintf(stderr, "         -W <vcid>        (pass virtual CAN network ID)\n");
+	fprintf(stderr, "         -R <vcid>:<vcid_mask> (receive VCIDs and pass "
+		"them to the fragments)\n");
+	fprintf(stderr, "         -z               (zero-copy fragments "
+		"via sendmmsg)\n");
+	fprintf(stderr, "         -s               (interleave fragments by "
+		"CAN XL priority - not with -z/-p)\n");
+	fprintf(stderr, "         -p <slots>       (reader thread with ring "
+		"buffer - power of 2, max %d)\n", MAX_RING_SLOTS);
 	fprintf(stderr, "         -v               (verbose)\n");
+	fprintf(stderr, "         -L <file>        (verbose output as binary "
+		"xllog records into file)\n");
+	fprintf(stderr, "\nThe verbose output is formatted by a separate thread. "
+		"Log records which\ndo not fit into its ring buffer are "
+		"dropped and counted.\n");
+	fprintf(stderr, "\nStatistics are printed to stderr on SIGINT/SIGTERM.\n");
 }
 
 int main(int argc, char **argv)
 {
 	int opt;
 	unsigned int fragsz = DEFAULT_FRAG_SIZE;
-	unsigned int txfcnt = 0;
-	canid_t transfer_id = DEFAULT_TRANSFER_ID;
+	unsigned int *fcnt;
+	canid_t transfer_id[MAX_TIDS];
+	unsigned int ntids = 0;
+	char *tidstr;
+	struct can_raw_vcid_options rx_vcid_opts = {};
 	__u8 vcid = 0;
 	__u8 vcid_pass_val = 0;
 	int vcid_pass = 0;
+	int zerocopy = 0;
+	int sched = 0;
+	unsigned int ringslots = 0;
 	int verbose = 0;
+	char *binlog = NULL;
+	FILE *logout = stdout;
 
 	int src, dst;
 	struct sockaddr_can addr;
 	struct can_raw_vcid_options vcid_opts = {};
-	struct can_filter rfilter;
-	struct canxl_frame cfsrc, cfdst;
-	struct llc_613_3 *srcllc = (struct llc_613_3 *) cfsrc.data;
-	struct llc_613_3 *llc = (struct llc_613_3 *) cfdst.data;
-	unsigned int dataptr = 0;
-	__u8 tx_pci = 0;
+	struct can_filter rfilter[MAX_TIDS];
+	struct canxl_frame rxframe;
+	struct canxl_frame *cfsrc = &rxframe;
+	struct xlring_slot *slot = NULL;
+	struct reader rd;
+	unsigned int nfrags, sent, len, i;
 
 	int nbytes, ret;
 	int sockopt = 1;
 	struct timeval tv;
+	struct sigaction sa = { .sa_handler = sigterm };
+	struct sigaction sw = { .sa_handler = sigwakeup };
+	struct timespec ts;
+	sigset_t sigs, oldsigs;
+	struct rusage ru;
+	double cpu;
 
-	while ((opt = getopt(argc, argv, "f:t:V:W:vh?")) != -1) {
+	while ((opt = getopt(argc, argv, "f:t:V:W:R:zsp:vL:h?")) != -1) {
 		switch (opt) {
 
 		case 'f':
@@ -84,10 +784,21 @@ int main(int argc, char **argv)
 			break;
 
 		case 't':
-			transfer_id = strtoul(optarg, NULL, 16);
-			if (transfer_id & ~CANXL_PRIO_MASK) {
-				print_usage(basename(argv[0]));
-				return 1;
+			for (tidstr = strtok(optarg, ","); tidstr;
+			     tidstr = strtok(NULL, ",")) {
+				canid_t tid = strtoul(tidstr, NULL, 16);
+
+				if (tid & ~CANXL_PRIO_MASK || ntids >= MAX_TIDS) {
+					print_usage(basename(argv[0]));
+					return 1;
+				}
+
+				/* skip duplicate transfer IDs */
+				if (tid2idx[tid])
+					continue;
+
+				transfer_id[ntids++] = tid;
+				tid2idx[tid] = ntids;
 			}
 			break;
 
@@ -106,10 +817,42 @@ int main(int argc, char **argv)
 			vcid_pass = 1;
 			break;
 
+		case 'R':
+			if (sscanf(optarg, "%hhx:%hhx",
+				   &rx_vcid_opts.rx_vcid,
+				   &rx_vcid_opts.rx_vcid_mask) != 2) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			rx_vcid_opts.flags = CAN_RAW_XL_VCID_RX_FILTER;
+			break;
+
+		case 'z':
+			zerocopy = 1;
+			break;
+
+		case 's':
+			sched = 1;
+			break;
+
+		case 'p':
+			ringslots = strtoul(optarg, NULL, 10);
+			if (!ringslots || ringslots > MAX_RING_SLOTS ||
+			    ringslots & (ringslots - 1)) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
 		case 'v':
 			verbose = 1;
 			break;
 
+		case 'L':
+			binlog = optarg;
+			verbose = 1;
+			break;
+
 		case '?':
 		case 'h':
 		default:
@@ -119,12 +862,28 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (!ntids) {
+		transfer_id[ntids++] = DEFAULT_TRANSFER_ID;
+		tid2idx[DEFAULT_TRANSFER_ID] = ntids;
+	}
+
+	/* TID index order = CAN XL priority order (for the scheduler) */
+	qsort(transfer_id, ntids, sizeof(canid_t), tidcmp);
+	for (i = 0; i < ntids; i++)
+		tid2idx[transfer_id[i]] = i + 1;
+
 	/* src_if and dst_if are two mandatory parameters */
 	if (argc - optind != 2) {
 		print_usage(basename(argv[0]));
 		exit(0);
 	}
 
+	/* the scheduler has its own receive path and sends each fragment */
+	if (sched && (zerocopy || ringslots)) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
 	/* src_if */
 	if (strlen(argv[optind]) >= IFNAMSIZ) {
 		printf("Name of src CAN device '%s' is too long!\n\n",
@@ -156,16 +915,38 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	/* filter only for transfer_id (= prio_id) */
-	rfilter.can_id = transfer_id;
-	rfilter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+	/* receive VCID tagged frames with the VCID inside prio */
+	if (rx_vcid_opts.flags) {
+		ret = setsockopt(src, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
+				 &rx_vcid_opts, sizeof(rx_vcid_opts));
+		if (ret < 0) {
+			perror("src sockopt CAN_RAW_XL_VCID_OPTS");
+			exit(1);
+		}
+	}
+
+	/* filter only for the transfer_id(s) (= prio_id) */
+	for (i = 0; i < ntids; i++) {
+		rfilter[i].can_id = transfer_id[i];
+		rfilter[i].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+	}
 	ret = setsockopt(src, SOL_CAN_RAW, CAN_RAW_FILTER,
-			 &rfilter, sizeof(rfilter));
+			 rfilter, ntids * sizeof(struct can_filter));
 	if (ret < 0) {
 		perror("src sockopt CAN_RAW_FILTER");
 		exit(1);
 	}
 
+	/* timestamps are delivered via cmsg to prevent ioctl() per frame */
+	if (verbose) {
+		ret = setsockopt(src, SOL_SOCKET, SO_TIMESTAMP,
+				 &sockopt, sizeof(sockopt));
+		if (ret < 0) {
+			perror("src sockopt SO_TIMESTAMP");
+			exit(1);
+		}
+	}
+
 	if (bind(src, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
 		perror("bind");
 		return 1;
@@ -204,7 +985,12 @@ int main(int argc, char **argv)
 		vcid_opts.rx_vcid_mask = CANXL_VCID_VAL_MASK;
 	}
 
-	if (vcid || vcid_pass) {
+	if (rx_vcid_opts.flags) {
+		/* each fragment gets the VCID of its source frame */
+		vcid_opts.flags |= CAN_RAW_XL_VCID_TX_PASS;
+	}
+
+	if (vcid || vcid_pass || rx_vcid_opts.flags) {
 		ret = setsockopt(dst, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
 				 &vcid_opts, sizeof(vcid_opts));
 		if (ret < 0) {
@@ -218,144 +1004,227 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	/* main loop */
-	while (1) {
-
-		/* read source CAN XL frame */
-		nbytes = read(src, &cfsrc, sizeof(struct canxl_frame));
-		if (nbytes < 0) {
-			perror("read");
-			return 1;
+	if (verbose) {
+		if (binlog) {
+			logout = fopen(binlog, "w");
+			if (!logout) {
+				perror(binlog);
+				return 1;
+			}
 		}
 
-		if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
-			fprintf(stderr, "read: no CAN frame\n");
+		/* the formatter thread does not handle SIGINT/SIGTERM */
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGINT);
+		sigaddset(&sigs, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+		if (xllog_start(&xllog, 1, logout, !!binlog, argv[optind], 0)) {
+			fprintf(stderr, "can not start the log formatter\n");
 			return 1;
 		}
+		logring = &xllog.ring[0];
+
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	}
+
+	/* terminate main loop with statistics output */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 
-		if (!(cfsrc.flags & CANXL_XLF)) {
-			fprintf(stderr, "read: no CAN XL frame flag\n");
+	if (sched) {
+		ret = sched_frag(src, dst, fragsz, verbose);
+		if (ret)
+			goto out;
+		running = 0;
+	}
+
+#ifdef USE_IO_URING
+	ret = (running && !ringslots) ?
+		uring_frag(src, dst, fragsz, verbose) : -1;
+	if (ret >= 0) {
+		running = 0;
+		if (ret)
+			goto out;
+	}
+#endif
+
+	/* prepare zero-copy fragment messages */
+	for (i = 0; i < MAX_FRAGS; i++) {
+		zciov[i][0].iov_base = &zchdr[i];
+		zciov[i][0].iov_len = sizeof(struct xlfrag_hdr);
+		zcmsg[i].msg_hdr.msg_iov = zciov[i];
+		zcmsg[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	if (ringslots) {
+		if (xlring_init(&xlring, ringslots)) {
+			fprintf(stderr, "can not allocate ring buffer\n");
 			return 1;
 		}
 
-		if (nbytes != CANXL_HDR_SIZE + cfsrc.len) {
-			printf("nbytes = %d\n", nbytes);
-			fprintf(stderr, "read: no CAN XL frame len\n");
+		/* only the main thread handles SIGINT/SIGTERM */
+		sigaction(SIGUSR1, &sw, NULL);
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGINT);
+		sigaddset(&sigs, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+		rd.src = src;
+		rd.verbose = verbose;
+		rd.err = 0;
+		if (pthread_create(&rd.thread, NULL, reader_thread, &rd)) {
+			perror("pthread_create");
 			return 1;
 		}
 
-		if (verbose) {
-			if (ioctl(src, SIOCGSTAMP, &tv) < 0) {
-				perror("SIOCGSTAMP");
-				return 1;
-			}
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	}
+
+	/* main loop */
+	while (running) {
 
-			/* print timestamp and device name */
-			printf("\n(%ld.%06ld) %s ", tv.tv_sec, tv.tv_usec,
-			       argv[optind]);
+		if (ringslots) {
+			/* release the slot of the previous source frame */
+			if (slot)
+				xlring_pop(&xlring);
 
-			printxlframe(&cfsrc);
+			/* get source CAN XL frame from the reader thread */
+			slot = xlring_cons_wait(&xlring, &running);
+			if (!slot)
+				break;
+
+			cfsrc = &slot->cf;
+			tv = slot->tv;
+		} else {
+			/* read source CAN XL frame */
+			ret = read_frame(src, cfsrc, &tv, verbose);
+			if (ret < 0) {
+				ret = 1;
+				goto out;
+			}
+			if (!ret)
+				continue;
 		}
 
+		if (verbose)
+			xllog_frame(logring, XLLOG_RX, XLLOG_F_START,
+				    xllog_tv(&tv), cfsrc);
+
 		/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
-		if ((cfsrc.flags & CANXL_SEC) &&
-		    (cfsrc.len >= LLC_613_3_SIZE) &&
-		    ((srcllc->pci & PCI_AOT_MASK) == CIA_613_3_AOT)) {
+		if (cia613_frame_type(cfsrc) != CIA613_NOFRAG) {
 
 			/* 613-3 inside 613-3 fragmentation is not allowed */
-			printf("detected tunnel encapsulation -> frame dropped\n");
+			xllog_msg(logring, XLLOG_M_TUNNEL, 0, 0, 0);
 			continue; /* wait for next frame */
 		}
 
 		/* check for unsegmented transfer (forwarding) */
-		if (cfsrc.len <= fragsz) {
+		if (cfsrc->len <= fragsz) {
 
 			/* just forward the unsegmented src frame */
-			nbytes = write(dst, &cfsrc, CANXL_HDR_SIZE + cfsrc.len);
-			if (nbytes != CANXL_HDR_SIZE + cfsrc.len) {
+			nbytes = write(dst, cfsrc, CANXL_HDR_SIZE + cfsrc->len);
+			if (nbytes != CANXL_HDR_SIZE + cfsrc->len) {
 				printf("nbytes = %d\n", nbytes);
 				perror("forward src canxl_frame");
 				exit(1);
 			}
+			fwframes++;
 
-			if (verbose) {
-				printf("FW - ");
-				printxlframe(&cfsrc);
-			}
+			if (verbose)
+				xllog_frame(logring, XLLOG_FW, 0,
+					    xllog_now(), cfsrc);
 			continue; /* wait for next frame */
 		}
 
 		/* send fragmented frame(s) */
+		pdus++;
 
-		/* initialize fixed LLC information */
-		llc->res = 0;
-
-		/* set protocol version number and AOT to tx_pci */
-		tx_pci = CIA_613_3_VERSION | CIA_613_3_AOT;
-
-		/* save original SEC bit for DLX (further SEC handling) */
-		if (cfsrc.flags & CANXL_SEC)
-			tx_pci |= PCI_SECN;
+		/* FCNT counter of this (TID, VCID) */
+		fcnt = fcnt_ctx(cfsrc->prio);
 
-		for (dataptr = 0; dataptr < cfsrc.len; dataptr += fragsz) {
+		if (zerocopy) {
+			/* fragment data is sent from cfsrc without copying */
+			nfrags = build_zcfrags(cfsrc, fragsz, fcnt, zchdr, zciov);
 
-			/* start of fragmentation => init header and set FF */
-			if (dataptr == 0) {
-				/* initial copy of CAN XL header w/o data */
-				/* The pass through VCID is fixed here! */
-				/* multiple VCIDs are not possible right now */
-				memcpy(&cfdst, &cfsrc, CANXL_HDR_SIZE);
-
-				/* set bit for segmentation in CAN XL header */
-				cfdst.flags |= CANXL_SEC;
-
-				/* first frame */
-				llc->pci = tx_pci | PCI_FF;
-			} else {
-				/* consecutive frame */
-				llc->pci = tx_pci; /* no FF/LF is set */
+			/* write all fragment frames of this PDU */
+			for (sent = 0; sent < nfrags; sent += ret) {
+				ret = sendmmsg(dst, &zcmsg[sent], nfrags - sent, 0);
+				if (ret < 0) {
+					perror("sendmmsg dst canxl_frame");
+					exit(1);
+				}
 			}
+			frags += nfrags;
 
-			/* update FCNT */
-			txfcnt++;
-			txfcnt &= 0xFFFFU;
-
-			/* set current FCNT counter into LLC information */
-			llc->fcnt = htons(txfcnt); /* network byte order */
-
-			/* copy CAN XL fragmented data content */
-			if (cfsrc.len - dataptr > fragsz) {
-				/* FF / CF */
-				memcpy(&cfdst.data[LLC_613_3_SIZE],
-				       &cfsrc.data[dataptr], fragsz);
-				/* increase length for the LLC information */
-				cfdst.len = fragsz + LLC_613_3_SIZE;
-			} else {
-				/* last frame */
-				llc->pci = tx_pci | PCI_LF;
-				memcpy(&cfdst.data[LLC_613_3_SIZE],
-				       &cfsrc.data[dataptr],
-				       cfsrc.len - dataptr);
-				cfdst.len = cfsrc.len - dataptr + LLC_613_3_SIZE;
-			}
+			if (verbose)
+				log_zcfrags(zchdr, zciov, nfrags);
+			continue; /* wait for next frame */
+		}
 
-			/* write fragment frame */
-			nbytes = write(dst, &cfdst, CANXL_HDR_SIZE + cfdst.len);
-			if (nbytes != CANXL_HDR_SIZE + cfdst.len) {
+		/* create all fragment frames with the fragment size kernel */
+		nfrags = frag_pdu(cfsrc, fragsz, fcnt, cfdst);
+
+		/* write fragment frames */
+		for (i = 0; i < nfrags; i++) {
+			len = CANXL_HDR_SIZE + cfdst[i].len;
+			nbytes = write(dst, &cfdst[i], len);
+			if (nbytes != (int)len) {
 				printf("nbytes = %d\n", nbytes);
 				perror("write dst canxl_frame");
 				exit(1);
 			}
+			frags++;
 
-			if (verbose) {
-				printf("TX - ");
-				printxlframe(&cfdst);
-			}
+			if (verbose)
+				xllog_frame(logring, XLLOG_TX, 0,
+					    xllog_now(), &cfdst[i]);
 		} /* send fragmented frame(s) */
-	} /* while (1) */
+	} /* while (running) */
+
+	if (ringslots) {
+		/* interrupt the blocking read() until the reader has finished */
+		do {
+			pthread_kill(rd.thread, SIGUSR1);
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+		} while (pthread_timedjoin_np(rd.thread, NULL, &ts));
+	}
+
+	/* CPU time consumed by this process (user + system) */
+	getrusage(RUSAGE_SELF, &ru);
+	cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+	fprintf(stderr, "PDUs %llu fragments %llu forwarded %llu "
+		"cpu %.3f s (%.3f us/PDU)%s\n", pdus, frags, fwframes, cpu,
+		pdus ? cpu * 1e6 / pdus : 0, zerocopy ? " zero-copy" : "");
+
+	if (ringslots) {
+		fprintf(stderr, "ring slots %u high-water mark %u "
+			"full ring stalls %llu\n", xlring.size, xlring.hwm,
+			xlring.stalls);
+		xlring_free(&xlring);
+	}
+
+	ret = (ringslots && rd.err) ? 1 : 0;
+out:
+	if (verbose) {
+		/* write the remaining log records */
+		xllog_stop(&xllog);
+		if (binlog)
+			fclose(logout);
+
+		fprintf(stderr, "log records %llu lost %llu\n",
+			xllog.written, xllog.lost);
+	}
 
 	close(src);
 	close(dst);
 
-	return 0;
+	return ret;
 }
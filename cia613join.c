@@ -9,7 +9,11 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -20,14 +24,267 @@
 #include <linux/sockios.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
-#include "cia-613-3.h"
+#include "libcia613.h"
 #include "printframe.h"
+#include "canlog.h"
+#include "xllog.h"
 
 #define DEFAULT_TRANSFER_ID 0x242
-#define NO_FCNT_VALUE 0x0FFF0000U
+#define MAX_TIDS 64 /* max number of configured transfer IDs */
+#define DEFAULT_CONTEXTS 16
+#define MAX_CONTEXTS 256
+#define VCID_VALUES (CANXL_VCID_VAL_MASK + 1)
+#define DEFAULT_BATCH 1
+#define MAX_BATCH 64
+#define DEFAULT_RX_TIMEOUT 1000 /* ms */
+#define DEFAULT_MAXLPCNT 2
+#define MAX_WORKERS 64
 
 extern int optind, opterr, optopt;
 
+/*
+ * Reassembly contexts are addressed by (prio, VCID) of the fragments.
+ *
+ * tid2idx[] maps the configured transfer IDs to 1 .. ntids and ctxmap[][]
+ * maps the (TID index, VCID) tuple to an assigned context 1 .. maxctx.
+ * Index 0 is used as 'not configured' / 'no context assigned' value.
+ *
+ * The hot reassembly metadata is kept in a small separate array so that
+ * the lookup does not touch the 2 KiB PDU buffers of unrelated contexts.
+ *
+ * Assigned contexts are linked in a list ordered by their last received
+ * fragment. As all contexts share the same rx timeout this list is also
+ * ordered by the deadline and stale contexts are evicted from its head.
+ * rxctx[0] is the list head.
+ *
+ * CiA 613-3 buffer management: the configured TIDs are sorted by their
+ * CAN XL priority, so the TID index order is the priority order. The
+ * bits in tidmap (bit n => TID index n + 1) mark TIDs with assigned
+ * contexts and tidctx[] links the contexts of each TID. This provides
+ * the highest/lowest priority transfer for the eviction rules in O(1).
+ *
+ * With multiple workers (-w) each worker thread handles a subset of the
+ * TIDs with its own sockets. All reassembly and I/O batch state below is
+ * thread local, so the workers share no mutable state.
+ */
+struct rxctx {
+	struct cia613_rx join; /* FCNT and reassembled PDU length */
+	unsigned int tididx; /* back reference for releasing ctxmap[][] */
+	unsigned int vcid;
+	unsigned int txpend; /* PDU buffer is queued for sendmmsg() */
+	unsigned int prev, next; /* timeout list */
+	unsigned int tprev, tnext; /* contexts of the same TID */
+	unsigned long long deadline; /* ns (CLOCK_MONOTONIC) */
+};
+
+static __thread unsigned int tid2idx[CANXL_PRIO_MASK + 1];
+static __thread __u16 ctxmap[MAX_TIDS + 1][VCID_VALUES];
+static __thread unsigned int tidctx[MAX_TIDS + 1]; /* first context of a TID */
+static __thread unsigned long long tidmap;
+static __thread struct rxctx rxctx[MAX_CONTEXTS + 1];
+static __thread struct canxl_frame pdubuf[MAX_CONTEXTS + 1];
+
+/*
+ * Unused contexts are kept in a FIFO so that a just released context
+ * (with a reassembled PDU that might still wait in the tx batch) is
+ * handed out as late as possible.
+ */
+static __thread __u16 freectx[MAX_CONTEXTS];
+static __thread unsigned int freehead, nfree;
+
+/* rx/tx batches for recvmmsg() and sendmmsg() */
+static __thread struct canxl_frame rxbuf[MAX_BATCH];
+static __thread struct iovec rxiov[MAX_BATCH];
+static __thread struct mmsghdr rxmsg[MAX_BATCH];
+static __thread char rxctrl[MAX_BATCH][CMSG_SPACE(sizeof(struct timeval))];
+static __thread struct iovec txiov[MAX_BATCH];
+static __thread struct mmsghdr txmsg[MAX_BATCH];
+static __thread unsigned int txctx[MAX_BATCH];
+static __thread unsigned int ntx;
+
+/* offline log mode (-r): log timestamps of the rx and tx frames */
+static __thread struct timeval rxtv[MAX_BATCH];
+static __thread struct timeval txtv[MAX_BATCH];
+static __thread struct timeval *frametv;
+
+/* configuration for all workers */
+static unsigned int maxctx = DEFAULT_CONTEXTS;
+static unsigned int batch = DEFAULT_BATCH;
+static unsigned int maxlpcnt = DEFAULT_MAXLPCNT;
+static int verbose;
+static char *srcname;
+static char *dstname;
+static char *logname; /* read src_if frames from a candump log */
+static struct canlog srclog;
+static struct can_raw_vcid_options vcid_opts;
+
+/* verbose output: one log ring per worker for the formatter thread */
+static struct xllog xllog;
+static __thread struct xllog_ring *logring;
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	int cpu; /* -1 => not pinned */
+	int src, dst;
+	canid_t transfer_id[MAX_TIDS];
+	unsigned int ntids;
+	int ret;
+};
+
+/* rx timeout handling */
+static unsigned long long rxtimeout; /* ns - 0 => disabled */
+static __thread unsigned long long now;
+
+/* statistics */
+static __thread unsigned long long rxframes, txframes, timeouts;
+static volatile sig_atomic_t running = 1;
+
+static void sigterm(int signo)
+{
+	running = 0;
+}
+
+/* interrupts a blocking recvmmsg() of a worker thread */
+static void sigwakeup(int signo)
+{
+}
+
+static void ctx_unlink(unsigned int ctx)
+{
+	rxctx[rxctx[ctx].prev].next = rxctx[ctx].next;
+	rxctx[rxctx[ctx].next].prev = rxctx[ctx].prev;
+}
+
+static void ctx_link_tail(unsigned int ctx)
+{
+	rxctx[ctx].prev = rxctx[0].prev;
+	rxctx[ctx].next = 0;
+	rxctx[rxctx[0].prev].next = ctx;
+	rxctx[0].prev = ctx;
+}
+
+/* (re)start the rx timeout of a context with a received fragment */
+static void ctx_touch(unsigned int ctx)
+{
+	ctx_unlink(ctx);
+	ctx_link_tail(ctx);
+	rxctx[ctx].deadline = now + rxtimeout;
+}
+
+static unsigned int ctx_get(unsigned int tididx, unsigned int vcid)
+{
+	unsigned int ctx;
+
+	if (!nfree)
+		return 0;
+
+	ctx = freectx[freehead];
+	freehead = (freehead + 1) % MAX_CONTEXTS;
+	nfree--;
+
+	rxctx[ctx].tididx = tididx;
+	rxctx[ctx].vcid = vcid;
+	ctxmap[tididx][vcid] = ctx;
+	ctx_link_tail(ctx);
+
+	/* add to the contexts of this TID */
+	rxctx[ctx].tprev = 0;
+	rxctx[ctx].tnext = tidctx[tididx];
+	rxctx[tidctx[tididx]].tprev = ctx;
+	tidctx[tididx] = ctx;
+	tidmap |= 1ULL << (tididx - 1);
+
+	return ctx;
+}
+
+static void ctx_put(unsigned int ctx)
+{
+	unsigned int tididx = rxctx[ctx].tididx;
+
+	/* remove from the contexts of this TID */
+	if (tididx) {
+		if (rxctx[ctx].tprev)
+			rxctx[rxctx[ctx].tprev].tnext = rxctx[ctx].tnext;
+		else
+			tidctx[tididx] = rxctx[ctx].tnext;
+		rxctx[rxctx[ctx].tnext].tprev = rxctx[ctx].tprev;
+		if (!tidctx[tididx])
+			tidmap &= ~(1ULL << (tididx - 1));
+	}
+
+	ctx_unlink(ctx);
+	ctxmap[rxctx[ctx].tididx][rxctx[ctx].vcid] = 0;
+	join_reset(&rxctx[ctx].join);
+	freectx[(freehead + nfree) % MAX_CONTEXTS] = ctx;
+	nfree++;
+}
+
+/* release all contexts that did not receive a fragment in time */
+static void ctx_expire(void)
+{
+	unsigned int ctx;
+
+	while ((ctx = rxctx[0].next) && rxctx[ctx].deadline <= now) {
+		xllog_msg(logring, XLLOG_M_TIMEOUT,
+			  pdubuf[ctx].prio & CANXL_PRIO_MASK, rxctx[ctx].vcid, 0);
+		timeouts++;
+		ctx_put(ctx);
+	}
+}
+
+static int tidcmp(const void *a, const void *b)
+{
+	return *(const canid_t *)a - *(const canid_t *)b;
+}
+
+static void tx_flush(int dst)
+{
+	unsigned int i, sent = 0;
+	int ret;
+
+	/* offline log mode: print the frames as dst_if log lines */
+	if (logname) {
+		/* after the verbose output of this batch */
+		if (verbose)
+			xllog_sync(&xllog);
+
+		for (i = 0; i < ntx; i++)
+			canlog_fprint(stdout, &txtv[i], dstname,
+				      txiov[i].iov_base, CANXL_MTU);
+		sent = ntx;
+	}
+
+	while (sent < ntx) {
+		ret = sendmmsg(dst, &txmsg[sent], ntx - sent, 0);
+		if (ret < 0) {
+			perror("sendmmsg dst canxl_frame");
+			exit(1);
+		}
+		sent += ret;
+	}
+
+	for (i = 0; i < ntx; i++)
+		rxctx[txctx[i]].txpend = 0;
+
+	txframes += ntx;
+	ntx = 0;
+}
+
+/* queue frame for transmission - ctx != 0 for a reassembled PDU buffer */
+static void tx_queue(int dst, struct canxl_frame *cf, unsigned int ctx)
+{
+	txiov[ntx].iov_base = cf;
+	txiov[ntx].iov_len = CANXL_HDR_SIZE + cf->len;
+	txctx[ntx] = ctx;
+	rxctx[ctx].txpend = 1;
+	if (frametv)
+		txtv[ntx] = *frametv;
+
+	if (++ntx == MAX_BATCH)
+		tx_flush(dst);
+}
+
 void print_usage(char *prg)
 {
 	fprintf(stderr, "%s - CAN XL CiA 613-3 gateway (join/defragmentation)\n\n", prg);
@@ -35,106 +292,447 @@ void print_usage(char *prg)
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "         -t <transfer_id>      (TRANSFER ID "
 		"- default: 0x%03X)\n", DEFAULT_TRANSFER_ID);
+	fprintf(stderr, "         -t <tid>,<tid>,...    (multiple TRANSFER IDs "
+		"- max %d)\n", MAX_TIDS);
+	fprintf(stderr, "         -c <contexts>         (reassembly buffers/maxbuffs "
+		"- default: %d, max %d)\n", DEFAULT_CONTEXTS, MAX_CONTEXTS);
+	fprintf(stderr, "         -l <maxLowPrioCount>  (0 = off "
+		"- default: %d)\n", DEFAULT_MAXLPCNT);
+	fprintf(stderr, "         -b <batchsize>        (frames per recvmmsg/sendmmsg "
+		"- default: %d, max %d)\n", DEFAULT_BATCH, MAX_BATCH);
+	fprintf(stderr, "         -T <timeout>          (reassembly timeout in ms, 0 = off "
+		"- default: %d ms)\n", DEFAULT_RX_TIMEOUT);
+	fprintf(stderr, "         -w <workers>          (worker threads with TID subsets "
+		"- max %d)\n", MAX_WORKERS);
 	fprintf(stderr, "         -V <vcid>:<vcid_mask> (VCID filter)\n");
+	fprintf(stderr, "         -r <logfile>          (read <src_if> frames from candump log)\n");
 	fprintf(stderr, "         -v                    (verbose)\n");
+	fprintf(stderr, "         -L <file>             (verbose output as binary "
+		"xllog records into file)\n");
+	fprintf(stderr, "\nFrame statistics are printed to stderr on SIGINT/SIGTERM.\n");
+	fprintf(stderr, "The verbose output is formatted by a separate thread. "
+		"Log records which\ndo not fit into its ring buffers are "
+		"dropped and counted.\n");
+	fprintf(stderr, "With -r the log is processed at maximum speed and the <dst_if>\n"
+		"frames are printed as candump log. Use 'any' as <src_if> for all\n"
+		"interfaces. The rx timeout is based on the log timestamps.\n");
 }
 
-int main(int argc, char **argv)
+/*
+ * fill the rx batch from the log like recvmmsg() on src_if with the
+ * CAN_RAW_FILTER/VCID filter of the worker
+ *
+ * returns the number of frames, 0 at the end of the log or -1 on error
+ */
+static int log_batch(struct worker *w)
 {
-	int opt;
-	unsigned int rxfragsz;
-	unsigned int fcnt = NO_FCNT_VALUE;
-	unsigned int rxfcnt;
-	canid_t transfer_id = DEFAULT_TRANSFER_ID;
-	int verbose = 0;
+	static struct canlog_frame lf;
+	unsigned int i, vcid;
+	int mtu = 0, n = 0;
+
+	while (n < (int)batch && (mtu = canlog_read(&srclog, &lf)) > 0) {
+		if (strcmp(srcname, "any") && strcmp(srcname, lf.ifname))
+			continue;
+
+		for (i = 0; i < w->ntids; i++) {
+			if ((lf.cc.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG |
+					     CAN_SFF_MASK)) == w->transfer_id[i])
+				break;
+		}
+		if (i == w->ntids)
+			continue;
+
+		if (mtu == CANXL_MTU) {
+			if (vcid_opts.flags & CAN_RAW_XL_VCID_RX_FILTER) {
+				vcid = (lf.xl.prio & CANXL_VCID_MASK) >>
+					CANXL_VCID_OFFSET;
+				if ((vcid & vcid_opts.rx_vcid_mask) !=
+				    (vcid_opts.rx_vcid & vcid_opts.rx_vcid_mask))
+					continue;
+			}
+			mtu = CANXL_HDR_SIZE + lf.xl.len;
+		}
 
-	int src, dst;
-	struct can_raw_vcid_options vcid_opts = {};
-	struct sockaddr_can addr;
-	struct can_filter rfilter;
-	struct canxl_frame cfsrc, cfdst;
-	struct llc_613_3 *llc = (struct llc_613_3 *) cfsrc.data;
-	unsigned int dataptr = 0;
+		memcpy(&rxbuf[n], &lf.xl, mtu);
+		rxmsg[n].msg_len = mtu;
+		rxtv[n] = lf.tv;
+		n++;
+	}
 
-	int nbytes, ret;
-	int sockopt = 1;
-	int vcid = 0;
-	struct timeval tv;
+	if (mtu < 0) {
+		fprintf(stderr, "%s: malformed line %u\n", logname,
+			srclog.line);
+		return -1;
+	}
 
-	while ((opt = getopt(argc, argv, "t:V:vh?")) != -1) {
-		switch (opt) {
+	return n;
+}
 
-		case 't':
-			transfer_id = strtoul(optarg, NULL, 16);
-			if (transfer_id & ~CANXL_PRIO_MASK) {
-				print_usage(basename(argv[0]));
+/* reassembly loop of a worker - returns the exit code */
+static int join_loop(struct worker *w)
+{
+	unsigned int rxfragsz, nextfcnt;
+	unsigned int tididx, vcidval, ctx, i;
+	unsigned int lpcnt = 0;
+	unsigned int lowidx, highidx;
+	int nframes, fidx;
+	struct canxl_frame *cfsrc;
+	struct llc_613_3 *llc;
+	unsigned int lf;
+	int nbytes, type, ret;
+	struct timeval tv = { 0 };
+	struct timespec ts, start, end;
+	struct cmsghdr *cmsg;
+	double elapsed;
+
+	if (verbose)
+		logring = &xllog.ring[w->id];
+
+	/* TID index order = CAN XL priority order (for buffer management) */
+	qsort(w->transfer_id, w->ntids, sizeof(canid_t), tidcmp);
+	for (i = 0; i < w->ntids; i++)
+		tid2idx[w->transfer_id[i]] = i + 1;
+
+	/* all reassembly contexts are unused */
+	for (i = 0; i < maxctx; i++) {
+		ctx_link_tail(maxctx - i);
+		ctx_put(maxctx - i);
+	}
+
+	/* prepare rx batch buffers */
+	for (i = 0; i < MAX_BATCH; i++) {
+		rxiov[i].iov_base = &rxbuf[i];
+		rxiov[i].iov_len = sizeof(struct canxl_frame);
+		rxmsg[i].msg_hdr.msg_iov = &rxiov[i];
+		rxmsg[i].msg_hdr.msg_iovlen = 1;
+		rxmsg[i].msg_hdr.msg_control = rxctrl[i];
+		txmsg[i].msg_hdr.msg_iov = &txiov[i];
+		txmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* main loop */
+	while (running) {
+
+		for (i = 0; i < batch; i++)
+			rxmsg[i].msg_hdr.msg_controllen = sizeof(rxctrl[i]);
+
+		if (logname) {
+			/* offline log mode - the log time is the rx time */
+			nframes = log_batch(w);
+			if (nframes < 0)
 				return 1;
+			if (!nframes)
+				break; /* end of log */
+
+			if (rxtimeout) {
+				now = rxtv[0].tv_sec * 1000000000ULL +
+					rxtv[0].tv_usec * 1000ULL;
+				ctx_expire();
 			}
-			break;
+		} else {
+			/* read batch of fragmented CAN XL source frames */
+			/* (MSG_WAITFORONE: do not wait for a complete batch) */
+			nframes = recvmmsg(w->src, rxmsg, batch, MSG_WAITFORONE,
+					   NULL);
+
+			if (rxtimeout) {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+				ctx_expire();
+			}
+		}
 
-		case 'V':
-			if (sscanf(optarg, "%hhx:%hhx",
-				   &vcid_opts.rx_vcid,
-				   &vcid_opts.rx_vcid_mask) != 2) {
-				print_usage(basename(argv[0]));
+		if (nframes < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("recvmmsg");
+			return 1;
+		}
+
+		rxframes += nframes;
+
+		for (fidx = 0; fidx < nframes; fidx++) {
+
+			cfsrc = &rxbuf[fidx];
+			llc = (struct llc_613_3 *) cfsrc->data;
+			nbytes = rxmsg[fidx].msg_len;
+			if (logname)
+				frametv = &rxtv[fidx];
+
+			if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
+				fprintf(stderr, "read: no CAN frame\n");
 				return 1;
 			}
-			vcid = 1;
-			break;
 
-		case 'v':
-			verbose = 1;
-			break;
+			if (!(cfsrc->flags & CANXL_XLF)) {
+				fprintf(stderr, "read: no CAN XL frame flag\n");
+				return 1;
+			}
 
-		case '?':
-		case 'h':
-		default:
-			print_usage(basename(argv[0]));
-			return 1;
-			break;
-		}
-	}
+			if (nbytes != CANXL_HDR_SIZE + cfsrc->len) {
+				printf("nbytes = %d\n", nbytes);
+				fprintf(stderr, "read: no CAN XL frame len\n");
+				return 1;
+			}
 
-	/* src_if and dst_if are two mandatory parameters */
-	if (argc - optind != 2) {
-		print_usage(basename(argv[0]));
-		exit(0);
-	}
+			if (verbose && logname) {
+				tv = rxtv[fidx];
+			} else if (verbose) {
+				for (cmsg = CMSG_FIRSTHDR(&rxmsg[fidx].msg_hdr); cmsg;
+				     cmsg = CMSG_NXTHDR(&rxmsg[fidx].msg_hdr, cmsg)) {
+					if (cmsg->cmsg_level == SOL_SOCKET &&
+					    cmsg->cmsg_type == SCM_TIMESTAMP)
+						memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+				}
+			}
 
-	/* src_if */
-	if (strlen(argv[optind]) >= IFNAMSIZ) {
-		printf("Name of src CAN device '%s' is too long!\n\n",
-		       argv[optind]);
-		return 1;
+			if (verbose)
+				xllog_frame(logring, XLLOG_RX, 0, xllog_tv(&tv),
+					    cfsrc);
+
+			/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
+			type = cia613_frame_type(cfsrc);
+			if (type == CIA613_NOFRAG) {
+				/* no CiA 613-3 fragment frame => just forward frame */
+
+				tx_queue(w->dst, cfsrc, 0);
+
+				if (verbose)
+					xllog_frame(logring, XLLOG_FW, 0,
+						    xllog_now(), cfsrc);
+				continue; /* wait for next frame */
+			}
+
+			if (type == CIA613_BADVER) {
+				if (verbose)
+					xllog_frame(logring, XLLOG_BADVER, 0,
+						    xllog_now(), cfsrc);
+
+				continue; /* wait for next frame */
+			}
+
+			/* retrieve real fragment data size from this CAN XL frame */
+			rxfragsz = cfsrc->len - LLC_613_3_SIZE;
+
+			/* lookup reassembly context for (prio, VCID) */
+			tididx = tid2idx[cfsrc->prio & CANXL_PRIO_MASK];
+			if (!tididx) {
+				/* not our TID - e.g. before CAN_RAW_FILTER was set */
+				continue; /* wait for next frame */
+			}
+			vcidval = (cfsrc->prio & CANXL_VCID_MASK) >> CANXL_VCID_OFFSET;
+
+			/* lowPrioCounter handling (CiA 613-3 E7) */
+			if (maxlpcnt && tidmap) {
+				/* highest priority TID with an ongoing transfer */
+				lowidx = __builtin_ctzll(tidmap) + 1;
+
+				if (tididx <= lowidx)
+					lpcnt = 0;
+				else
+					lpcnt++;
+
+				if (lpcnt >= maxlpcnt) {
+					ctx = tidctx[lowidx];
+					xllog_msg(logring, XLLOG_M_LOWPRIO,
+						  pdubuf[ctx].prio & CANXL_PRIO_MASK,
+						  lpcnt, maxlpcnt);
+					ctx_put(ctx);
+				}
+			} else {
+				lpcnt = 0;
+			}
+
+			ctx = ctxmap[tididx][vcidval];
+
+			/* check for first frame */
+			if (type == CIA613_FF) {
+
+				ret = cia613_fragsz_check(type, rxfragsz);
+				if (ret == CIA613_E_SIZE) {
+					xllog_msg(logring, XLLOG_M_FF_SIZE, 0, 0, 0);
+					continue;
+				}
+
+				if (ret == CIA613_E_STEP) {
+					xllog_msg(logring, XLLOG_M_FF_STEP, 0, 0, 0);
+					continue;
+				}
+
+				/* restart ongoing transfer or assign a new context */
+				if (!ctx)
+					ctx = ctx_get(tididx, vcidval);
+
+				if (!ctx) {
+					/* lowest priority TID with an ongoing transfer */
+					highidx = 64 - __builtin_clzll(tidmap);
+
+					if (tididx >= highidx) {
+						/* CiA 613-3 E6 */
+						xllog_msg(logring, XLLOG_M_FULL,
+							  0, 0, 0);
+						continue;
+					}
+
+					/* CiA 613-3 E5: grab buffer of lower prio TID */
+					ctx = tidctx[highidx];
+					xllog_msg(logring, XLLOG_M_GRAB,
+						  pdubuf[ctx].prio & CANXL_PRIO_MASK,
+						  0, 0);
+					ctx_put(ctx);
+					ctx = ctx_get(tididx, vcidval);
+				}
+
+				/* reassembled PDU in this buffer not sent yet? */
+				if (rxctx[ctx].txpend)
+					tx_flush(w->dst);
+
+				/* restart reassembly with the first fragment data */
+				join_push(&rxctx[ctx].join, &pdubuf[ctx], cfsrc);
+				ctx_touch(ctx);
+
+				continue; /* wait for next frame */
+			} /* FF */
+
+			if (type == CIA613_RESERVED) {
+				/* invalid (reserved) FF/LF combination */
+				xllog_msg(logring, XLLOG_M_RESERVED, 0, 0, 0);
+				continue; /* wait for next frame */
+			}
+
+			/* consecutive frame (FF/LF are unset) or last frame */
+			lf = (type == CIA613_LF); /* LF message id offset */
+
+			/* check FCNT, fragment size and append fragment data */
+			nextfcnt = join_next_fcnt(ctx ? &rxctx[ctx].join : NULL);
+			ret = join_push(ctx ? &rxctx[ctx].join : NULL, &pdubuf[ctx],
+					cfsrc);
+
+			if (ret == CIA613_E_FCNT) {
+				xllog_msg(logring, XLLOG_M_CF_FCNT + lf,
+					  nextfcnt, ntohs(llc->fcnt), 0);
+				/* only FF can set a proper fcnt value */
+				if (ctx)
+					ctx_put(ctx);
+				continue;
+			}
+
+			if (type == CIA613_CF)
+				ctx_touch(ctx);
+
+			switch (ret) {
+			case CIA613_E_SIZE:
+				xllog_msg(logring, XLLOG_M_CF_SIZE + lf, 0, 0, 0);
+				continue;
+
+			case CIA613_E_STEP:
+				xllog_msg(logring, XLLOG_M_CF_STEP + lf, 0, 0, 0);
+				continue;
+
+			case CIA613_E_OVERFLOW:
+				xllog_msg(logring, XLLOG_M_CF_OVERFLOW + lf, 0, 0, 0);
+				continue;
+
+			case CIA613_DONE:
+				/* queue 'reassembled' CAN XL frame for sendmmsg() */
+				tx_queue(w->dst, &pdubuf[ctx], ctx);
+
+				if (verbose)
+					xllog_frame(logring, XLLOG_TX,
+						    XLLOG_F_END, xllog_now(),
+						    &pdubuf[ctx]);
+
+				/* only FF can set a proper fcnt value */
+				ctx_put(ctx);
+				break;
+			}
+
+		} /* for (fidx) */
+
+		/* send forwarded and reassembled frames of this batch */
+		if (ntx)
+			tx_flush(w->dst);
+		else if (verbose && logname)
+			xllog_sync(&xllog);
+
+	} /* while (running) */
+
+	/* frames of the last log batch */
+	if (ntx)
+		tx_flush(w->dst);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	fprintf(stderr, "worker %u: rx frames %llu tx frames %llu in %.3f s "
+		"(%.0f rx frames/s) batch %u timeouts %llu\n", w->id, rxframes,
+		txframes, elapsed, elapsed > 0 ? rxframes / elapsed : 0, batch,
+		timeouts);
+
+	if (logname) {
+		canlog_close(&srclog);
+	} else {
+		close(w->src);
+		close(w->dst);
 	}
 
-	/* dst_if */
-	if (strlen(argv[optind + 1]) >= IFNAMSIZ) {
-		printf("Name of dst CAN device '%s' is too long!\n\n",
-		       argv[optind]);
-		return 1;
+	return 0;
+}
+
+static void *join_thread(void *arg)
+{
+	struct worker *w = arg;
+	cpu_set_t cpus;
+
+	if (w->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(w->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+			fprintf(stderr, "worker %u: can not pin to CPU %d\n",
+				w->id, w->cpu);
 	}
 
+	w->ret = join_loop(w);
+
+	/* terminate the other workers too */
+	running = 0;
+	kill(getpid(), SIGTERM);
+
+	return NULL;
+}
+
+/* open the src/dst sockets of a worker with its TID filter subset */
+static void open_sockets(struct worker *w)
+{
+	struct sockaddr_can addr;
+	struct can_filter rfilter[MAX_TIDS];
+	struct timeval rcvtimeo;
+	unsigned int i;
+	int sockopt = 1;
+	int ret;
+
 	/* open src socket */
-	src = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-	if (src < 0) {
+	w->src = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (w->src < 0) {
 		perror("src socket");
-		return 1;
+		exit(1);
 	}
 	addr.can_family = AF_CAN;
-	addr.can_ifindex = if_nametoindex(argv[optind]);
+	addr.can_ifindex = if_nametoindex(srcname);
 
 	/* enable CAN XL frames */
-	ret = setsockopt(src, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+	ret = setsockopt(w->src, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
 			 &sockopt, sizeof(sockopt));
 	if (ret < 0) {
 		perror("src sockopt CAN_RAW_XL_FRAMES");
 		exit(1);
 	}
 
-	if (vcid) {
-		vcid_opts.flags = CAN_RAW_XL_VCID_RX_FILTER;
-		ret = setsockopt(src, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
+	if (vcid_opts.flags) {
+		ret = setsockopt(w->src, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
 				 &vcid_opts, sizeof(vcid_opts));
 		if (ret < 0) {
 			perror("sockopt CAN_RAW_XL_VCID_OPTS");
@@ -142,274 +740,301 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* filter only for transfer_id (= prio_id) */
-	rfilter.can_id = transfer_id;
-	rfilter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
-	ret = setsockopt(src, SOL_CAN_RAW, CAN_RAW_FILTER,
-			 &rfilter, sizeof(rfilter));
+	/* filter only for the transfer_id(s) (= prio_id) */
+	for (i = 0; i < w->ntids; i++) {
+		rfilter[i].can_id = w->transfer_id[i];
+		rfilter[i].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+	}
+	ret = setsockopt(w->src, SOL_CAN_RAW, CAN_RAW_FILTER,
+			 rfilter, w->ntids * sizeof(struct can_filter));
 	if (ret < 0) {
 		perror("src sockopt CAN_RAW_FILTER");
 		exit(1);
 	}
 
-	if (bind(src, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	/* wake up from recvmmsg() to evict stale contexts on idle bus */
+	if (rxtimeout) {
+		rcvtimeo.tv_sec = rxtimeout / 2000000000ULL;
+		rcvtimeo.tv_usec = (rxtimeout % 2000000000ULL) / 2000;
+		ret = setsockopt(w->src, SOL_SOCKET, SO_RCVTIMEO,
+				 &rcvtimeo, sizeof(rcvtimeo));
+		if (ret < 0) {
+			perror("src sockopt SO_RCVTIMEO");
+			exit(1);
+		}
+	}
+
+	/* timestamps are delivered via cmsg to prevent ioctl() per frame */
+	if (verbose) {
+		ret = setsockopt(w->src, SOL_SOCKET, SO_TIMESTAMP,
+				 &sockopt, sizeof(sockopt));
+		if (ret < 0) {
+			perror("src sockopt SO_TIMESTAMP");
+			exit(1);
+		}
+	}
+
+	if (bind(w->src, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
 		perror("bind");
-		return 1;
+		exit(1);
 	}
 
 	/* open dst socket */
-	dst = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-	if (dst < 0) {
+	w->dst = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (w->dst < 0) {
 		perror("dst socket");
-		return 1;
+		exit(1);
 	}
 	addr.can_family = AF_CAN;
-	addr.can_ifindex = if_nametoindex(argv[optind + 1]);
+	addr.can_ifindex = if_nametoindex(dstname);
 
 	/* enable CAN XL frames */
-	ret = setsockopt(dst, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+	ret = setsockopt(w->dst, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
 			 &sockopt, sizeof(sockopt));
 	if (ret < 0) {
 		perror("dst sockopt CAN_RAW_XL_FRAMES");
 		exit(1);
 	}
 
-	if (bind(dst, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	if (bind(w->dst, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
 		perror("bind");
-		return 1;
+		exit(1);
 	}
+}
 
-	/* main loop */
-	while (1) {
-
-		/* read fragmented CAN XL source frame */
-		nbytes = read(src, &cfsrc, sizeof(struct canxl_frame));
-		if (nbytes < 0) {
-			perror("read");
-			return 1;
-		}
+int main(int argc, char **argv)
+{
+	int opt;
+	canid_t transfer_id[MAX_TIDS];
+	unsigned int ntids = 0;
+	unsigned int nworkers = 1;
+	unsigned int timeout = DEFAULT_RX_TIMEOUT;
+	unsigned int i;
+	char *tidstr;
+	char *binlog = NULL;
+	FILE *logout = stdout;
+	int ncpus, ret = 0;
+
+	static struct worker workers[MAX_WORKERS];
+	struct sigaction sa = { .sa_handler = sigterm };
+	struct sigaction sw = { .sa_handler = sigwakeup };
+	struct timespec ts;
+	sigset_t sigs, oldsigs;
+
+	while ((opt = getopt(argc, argv, "t:c:l:b:T:w:V:r:vL:h?")) != -1) {
+		switch (opt) {
+		case 't':
+			for (tidstr = strtok(optarg, ","); tidstr;
+			     tidstr = strtok(NULL, ",")) {
+				canid_t tid = strtoul(tidstr, NULL, 16);
 
-		if (nbytes < CANXL_HDR_SIZE + CANXL_MIN_DLEN) {
-			fprintf(stderr, "read: no CAN frame\n");
-			return 1;
-		}
+				if (tid & ~CANXL_PRIO_MASK || ntids >= MAX_TIDS) {
+					print_usage(basename(argv[0]));
+					return 1;
+				}
 
-		if (!(cfsrc.flags & CANXL_XLF)) {
-			fprintf(stderr, "read: no CAN XL frame flag\n");
-			return 1;
-		}
+				/* skip duplicate transfer IDs */
+				if (tid2idx[tid])
+					continue;
 
-		if (nbytes != CANXL_HDR_SIZE + cfsrc.len) {
-			printf("nbytes = %d\n", nbytes);
-			fprintf(stderr, "read: no CAN XL frame len\n");
-			return 1;
-		}
+				transfer_id[ntids++] = tid;
+				tid2idx[tid] = ntids;
+			}
+			break;
 
-		if (verbose) {
-			if (ioctl(src, SIOCGSTAMP, &tv) < 0) {
-				perror("SIOCGSTAMP");
+		case 'c':
+			maxctx = strtoul(optarg, NULL, 10);
+			if (maxctx < 1 || maxctx > MAX_CONTEXTS) {
+				print_usage(basename(argv[0]));
 				return 1;
 			}
+			break;
 
-			/* print timestamp and device name */
-			printf("(%ld.%06ld) %s ", tv.tv_sec, tv.tv_usec,
-			       argv[optind]);
-
-			printxlframe(&cfsrc);
-		}
-
-		/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
-		if (!((cfsrc.flags & CANXL_SEC) &&
-		      (cfsrc.len >= LLC_613_3_SIZE) &&
-		      ((llc->pci & PCI_AOT_MASK) == CIA_613_3_AOT))) {
-			/* no CiA 613-3 fragment frame => just forward frame */
-
-			nbytes = write(dst, &cfsrc, CANXL_HDR_SIZE + cfsrc.len);
-			if (nbytes != CANXL_HDR_SIZE + cfsrc.len) {
-				printf("nbytes = %d\n", nbytes);
-				perror("forward src canxl_frame");
-				exit(1);
-			}
+		case 'l':
+			maxlpcnt = strtoul(optarg, NULL, 10);
+			break;
 
-			if (verbose) {
-				printf("FW - ");
-				printxlframe(&cfsrc);
+		case 'b':
+			batch = strtoul(optarg, NULL, 10);
+			if (batch < 1 || batch > MAX_BATCH) {
+				print_usage(basename(argv[0]));
+				return 1;
 			}
-			continue; /* wait for next frame */
-		}
-
-		if ((llc->pci & PCI_VX_MASK) != CIA_613_3_VERSION) {
-			if (verbose)
-				printf("Dropped frame due to wrong CiA 613-3 version\n");
-
-			continue; /* wait for next frame */
-		}
-
-		/* common FCNT reception handling */
-		rxfcnt = ntohs(llc->fcnt); /* read from PCI with byte order */
-
-		/* retrieve real fragment data size from this CAN XL frame */
-		rxfragsz = cfsrc.len - LLC_613_3_SIZE;
+			break;
 
-		/* check for first frame */
-		if ((llc->pci & PCI_XF_MASK) == PCI_FF) {
+		case 'T':
+			timeout = strtoul(optarg, NULL, 10);
+			break;
 
-			if (rxfragsz <  MIN_FRAG_SIZE || rxfragsz > MAX_FRAG_SIZE) {
-				printf("FF: dropped LLC frame illegal fragment size!\n");
-				continue;
+		case 'w':
+			nworkers = strtoul(optarg, NULL, 10);
+			if (nworkers < 1 || nworkers > MAX_WORKERS) {
+				print_usage(basename(argv[0]));
+				return 1;
 			}
+			break;
 
-			if (rxfragsz % FRAG_STEP_SIZE) {
-				printf("FF: dropped LLC frame illegal fragment step size!\n");
-				continue;
+		case 'V':
+			if (sscanf(optarg, "%hhx:%hhx",
+				   &vcid_opts.rx_vcid,
+				   &vcid_opts.rx_vcid_mask) != 2) {
+				print_usage(basename(argv[0]));
+				return 1;
 			}
+			vcid_opts.flags = CAN_RAW_XL_VCID_RX_FILTER;
+			break;
 
-			/* take current rxfcnt as initial fcnt */
-			fcnt = rxfcnt;
-
-			/* copy CAN XL header w/o data */
-			memcpy(&cfdst, &cfsrc, CANXL_HDR_SIZE);
-
-			/* clear SEC bit from our segmentation process */
-			cfdst.flags &= ~CANXL_SEC;
-
-			/* restore original SEC bit from DLX (for other AOT) */
-			if (llc->pci & PCI_SECN)
-				cfdst.flags |= CANXL_SEC;
-
-			/* 'reassembled' length without the LLC information */
-			cfdst.len = rxfragsz;
-
-			/* copy CAN XL fragment data w/o LLC information */
-			memcpy(&cfdst.data[0],
-			       &cfsrc.data[LLC_613_3_SIZE],
-			       cfdst.len);
-
-			/* update data pointer for next fragment data */
-			dataptr = cfdst.len;
+		case 'r':
+			logname = optarg;
+			break;
 
-			if (0) {
-				printf("TX - ");
-				printxlframe(&cfdst);
-				printf("\n");
-			}
-			continue; /* wait for next frame */
-		} /* FF */
+		case 'v':
+			verbose = 1;
+			break;
 
-		/* consecutive frame (FF/LF are unset) */
-		if ((llc->pci & PCI_XF_MASK) == 0) {
+		case 'L':
+			binlog = optarg;
+			verbose = 1;
+			break;
 
-			if (fcnt != NO_FCNT_VALUE) {
-				fcnt++;
-				fcnt &= 0xFFFFU;
-			}
+		case '?':
+		case 'h':
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
 
-			/* check that rxfcnt has increased */
-			if (fcnt != rxfcnt) {
-				printf("CF: abort reception wrong FCNT! (%d/%d)\n",
-				       fcnt, rxfcnt);
-				/* only FF can set a proper fcnt value */
-				fcnt = NO_FCNT_VALUE;
-				continue;
-			}
+	if (!ntids) {
+		transfer_id[ntids++] = DEFAULT_TRANSFER_ID;
+		tid2idx[DEFAULT_TRANSFER_ID] = ntids;
+	}
+	rxtimeout = timeout * 1000000ULL;
 
-			if (rxfragsz <  MIN_FRAG_SIZE || rxfragsz > MAX_FRAG_SIZE) {
-				printf("CF: dropped LLC frame illegal fragment size!\n");
-				continue;
-			}
+	/* src_if and dst_if are two mandatory parameters */
+	if (argc - optind != 2) {
+		print_usage(basename(argv[0]));
+		exit(0);
+	}
 
-			if (rxfragsz % FRAG_STEP_SIZE) {
-				printf("CF: dropped LLC frame illegal fragment step size!\n");
-				continue;
-			}
+	/* src_if */
+	if (strlen(argv[optind]) >= IFNAMSIZ) {
+		printf("Name of src CAN device '%s' is too long!\n\n",
+		       argv[optind]);
+		return 1;
+	}
 
-			/* make sure the data fits into the unfragmented frame */
-			if (dataptr + rxfragsz > CANXL_MAX_DLEN) {
-				printf("dropped CF frame size overflow!\n");
-				continue;
-			}
+	/* dst_if */
+	if (strlen(argv[optind + 1]) >= IFNAMSIZ) {
+		printf("Name of dst CAN device '%s' is too long!\n\n",
+		       argv[optind]);
+		return 1;
+	}
+	srcname = argv[optind];
+	dstname = argv[optind + 1];
 
-			/* copy CAN XL fragment data w/o LLC information */
-			memcpy(&cfdst.data[dataptr],
-			       &cfsrc.data[LLC_613_3_SIZE],
-			       rxfragsz);
+	/* offline log mode: one worker without sockets */
+	if (logname) {
+		if (canlog_open(&srclog, logname) < 0) {
+			perror(logname);
+			return 1;
+		}
+		nworkers = 1;
+	}
 
-			/* update data pointer and len for next fragment data */
-			dataptr += rxfragsz;
-			cfdst.len += rxfragsz;
+	/* distribute the TIDs (sorted by prio) round robin to the workers */
+	if (nworkers > ntids)
+		nworkers = ntids;
 
-			if (0) {
-				printf("TX - ");
-				printxlframe(&cfdst);
-				printf("\n");
-			}
-			continue; /* wait for next frame */
-		} /* CF */
+	qsort(transfer_id, ntids, sizeof(canid_t), tidcmp);
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-		/* last frame */
-		if ((llc->pci & PCI_XF_MASK) == PCI_LF) {
+	for (i = 0; i < nworkers; i++) {
+		workers[i].id = i;
+		workers[i].cpu = (nworkers > 1) ? (int)i % ncpus : -1;
+	}
 
-			if (fcnt != NO_FCNT_VALUE) {
-				fcnt++;
-				fcnt &= 0xFFFFU;
-			}
+	for (i = 0; i < ntids; i++) {
+		struct worker *w = &workers[i % nworkers];
 
-			/* check that rxfcnt has increased */
-			if (fcnt != rxfcnt) {
-				printf("LF: abort reception wrong FCNT! (%d/%d)\n",
-				       fcnt, rxfcnt);
-				/* only FF can set a proper fcnt value */
-				fcnt = NO_FCNT_VALUE;
-				continue;
-			}
+		w->transfer_id[w->ntids++] = transfer_id[i];
+	}
 
-			if (rxfragsz < LF_MIN_FRAG_SIZE || rxfragsz > MAX_FRAG_SIZE) {
-				printf("LF: dropped LLC frame illegal fragment size!\n");
-				continue;
+	for (i = 0; i < nworkers && !logname; i++)
+		open_sockets(&workers[i]);
+
+	/* worker and formatter threads only get the wakeup signal */
+	sigaction(SIGUSR1, &sw, NULL);
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+	if (verbose) {
+		if (binlog) {
+			logout = fopen(binlog, "w");
+			if (!logout) {
+				perror(binlog);
+				return 1;
 			}
+		}
 
-			/* make sure the data fits into the unfragmented frame */
-			if (dataptr + rxfragsz > CANXL_MAX_DLEN) {
-				printf("dropped LF frame size overflow!\n");
-				continue;
-			}
+		if (xllog_start(&xllog, nworkers, logout, !!binlog, srcname,
+				!!logname)) {
+			fprintf(stderr, "can not start the log formatter\n");
+			return 1;
+		}
+	}
 
-			/* copy CAN XL fragment data w/o LLC information */
-			memcpy(&cfdst.data[dataptr],
-			       &cfsrc.data[LLC_613_3_SIZE],
-			       rxfragsz);
+	/* terminate main loop with statistics output */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 
-			/* update length value with last frame content size */
-			cfdst.len += rxfragsz;
+	if (nworkers == 1) {
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		ret = join_loop(&workers[0]);
+		goto out;
+	}
 
-			/* write 'reassembled' CAN XL frame */
-			nbytes = write(dst, &cfdst, CANXL_HDR_SIZE + cfdst.len);
-			if (nbytes != CANXL_HDR_SIZE + cfdst.len) {
-				printf("nbytes = %d\n", nbytes);
-				perror("write dst canxl_frame");
-				exit(1);
-			}
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, join_thread,
+				   &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
 
-			if (verbose) {
-				printf("TX - ");
-				printxlframe(&cfdst);
-				printf("\n");
+	/* wait for SIGINT/SIGTERM (also raised by a failing worker) */
+	while (running)
+		sigsuspend(&oldsigs);
+
+	/* interrupt the blocking recvmmsg() until the worker has finished */
+	for (i = 0; i < nworkers; i++) {
+		do {
+			pthread_kill(workers[i].thread, SIGUSR1);
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
 			}
+		} while (pthread_timedjoin_np(workers[i].thread, NULL, &ts));
 
-			/* only FF can set a proper fcnt value */
-			fcnt = NO_FCNT_VALUE;
-
-			continue; /* wait for next frame */
-		} /* LF */
-
-		/* invalid (reserved) FF/LF combination */
-		printf("FF/LF: dropped LLC frame with reserved FF/LF bits set!\n");
-		continue; /* wait for next frame */
+		if (workers[i].ret)
+			ret = workers[i].ret;
+	}
 
-	} /* while(1) */
+out:
+	if (verbose) {
+		/* write the remaining log records */
+		xllog_stop(&xllog);
+		if (binlog)
+			fclose(logout);
 
-	close(src);
-	close(dst);
+		fprintf(stderr, "log records %llu lost %llu\n",
+			xllog.written, xllog.lost);
+	}
 
-	return 0;
+	return ret;
 }
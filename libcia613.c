@@ -0,0 +1,467 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * libcia613.c - CAN CiA 613-3 fragmentation/reassembly engine
+ *
+ */
+
+#include <string.h>
+#include <arpa/inet.h> /* for network byte order conversion */
+
+#include "libcia613.h"
+
+int cia613_frame_type(const struct canxl_frame *cf)
+{
+	const struct llc_613_3 *llc = (const struct llc_613_3 *) cf->data;
+
+	/* check for SEC bit and CiA 613-3 AOT (fragmentation) */
+	if (!((cf->flags & CANXL_SEC) &&
+	      (cf->len >= LLC_613_3_SIZE) &&
+	      ((llc->pci & PCI_AOT_MASK) == CIA_613_3_AOT)))
+		return CIA613_NOFRAG;
+
+	if ((llc->pci & PCI_VX_MASK) != CIA_613_3_VERSION)
+		return CIA613_BADVER;
+
+	switch (llc->pci & PCI_XF_MASK) {
+	case PCI_FF:
+		return CIA613_FF;
+	case 0:
+		return CIA613_CF;
+	case PCI_LF:
+		return CIA613_LF;
+	default:
+		return CIA613_RESERVED;
+	}
+}
+
+int cia613_fragsz_check(int type, unsigned int fragsz)
+{
+	if (type == CIA613_LF) {
+		if (fragsz < LF_MIN_FRAG_SIZE || fragsz > MAX_FRAG_SIZE)
+			return CIA613_E_SIZE;
+
+		return CIA613_OK;
+	}
+
+	if (fragsz < MIN_FRAG_SIZE || fragsz > MAX_FRAG_SIZE)
+		return CIA613_E_SIZE;
+
+	if (fragsz % FRAG_STEP_SIZE)
+		return CIA613_E_STEP;
+
+	return CIA613_OK;
+}
+
+void frag_init(struct cia613_frag *f, const struct canxl_frame *src,
+	       unsigned int fragsz, unsigned int *fcnt)
+{
+	f->src = src;
+	f->fcnt = fcnt;
+	f->fragsz = fragsz;
+	f->dataptr = 0;
+
+	/* set protocol version number and AOT to tx_pci */
+	f->tx_pci = CIA_613_3_VERSION | CIA_613_3_AOT;
+
+	/* save original SEC bit for DLX (further SEC handling) */
+	if (src->flags & CANXL_SEC)
+		f->tx_pci |= PCI_SECN;
+}
+
+unsigned int frag_next_hdr(struct cia613_frag *f, struct xlfrag_hdr *hdr,
+			   const __u8 **data)
+{
+	const struct canxl_frame *src = f->src;
+	unsigned int len;
+
+	if (f->dataptr >= src->len)
+		return 0;
+
+	/* CAN XL header w/o data (including the VCID of the source frame) */
+	memcpy(hdr, src, CANXL_HDR_SIZE);
+
+	/* set bit for segmentation in CAN XL header */
+	hdr->flags |= CANXL_SEC;
+
+	if (src->len - f->dataptr > f->fragsz) {
+		/* FF / CF */
+		hdr->llc.pci = f->tx_pci;
+		if (f->dataptr == 0)
+			hdr->llc.pci |= PCI_FF;
+		len = f->fragsz;
+	} else {
+		/* last frame */
+		hdr->llc.pci = f->tx_pci | PCI_LF;
+		len = src->len - f->dataptr;
+	}
+	hdr->llc.res = 0;
+
+	/* increase length for the LLC information */
+	hdr->len = len + LLC_613_3_SIZE;
+
+	/* update FCNT */
+	(*f->fcnt)++;
+	*f->fcnt &= 0xFFFFU;
+	hdr->llc.fcnt = htons(*f->fcnt); /* network byte order */
+
+	/* data slice in the source frame */
+	*data = &src->data[f->dataptr];
+	f->dataptr += len;
+
+	return len;
+}
+
+unsigned int frag_next(struct cia613_frag *f, struct canxl_frame *dst)
+{
+	const __u8 *data;
+	unsigned int len;
+
+	len = frag_next_hdr(f, (struct xlfrag_hdr *)dst, &data);
+	if (!len)
+		return 0;
+
+	/* copy CAN XL fragmented data content */
+	memcpy(&dst->data[LLC_613_3_SIZE], data, len);
+
+	return CANXL_HDR_SIZE + LLC_613_3_SIZE + len;
+}
+
+/*
+ * Fragment size specific kernels
+ *
+ * Only CIA613_FRAGSZ_NUM fragment sizes are legal. The kernels below are
+ * instantiated for each legal size with a constant fragment size, so the
+ * fragment count, the data copy sizes and the LF remainder are computed
+ * with shifts/masks and the data is copied with fixed size moves.
+ */
+_Static_assert(MIN_FRAG_SIZE == FRAG_STEP_SIZE,
+	       "fragment size index calculation needs MIN = STEP");
+
+static inline unsigned int fragsz_idx(unsigned int fragsz)
+{
+	return fragsz / FRAG_STEP_SIZE - 1;
+}
+
+/*
+ * constant size data copy: small sizes are inlined as vector moves in
+ * FRAG_STEP_SIZE chunks. Larger sizes are left to the (vectorized) libc
+ * memcpy() which is faster than the 'rep movs' the compiler would
+ * generate for a large constant size.
+ */
+#define COPY_K_INLINE_MAX 256
+
+static inline __attribute__((always_inline))
+void copy_k(__u8 *dst, const __u8 *src, const unsigned int sz)
+{
+	size_t n = sz;
+	unsigned int i;
+
+	if (sz <= COPY_K_INLINE_MAX) {
+#pragma GCC unroll 2
+		for (i = 0; i < sz; i += FRAG_STEP_SIZE)
+			memcpy(&dst[i], &src[i], FRAG_STEP_SIZE);
+		return;
+	}
+
+	/* hide the constant size from the compiler */
+	__asm__("" : "+r" (n));
+	memcpy(dst, src, n);
+}
+
+static inline __attribute__((always_inline))
+void frag_frame_k(struct canxl_frame *dst, const struct canxl_frame *src,
+		  __u8 pci, unsigned int len, unsigned int *fcnt)
+{
+	struct llc_613_3 *llc = (struct llc_613_3 *) dst->data;
+
+	/* CAN XL header w/o data with segmentation bit */
+	memcpy(dst, src, CANXL_HDR_SIZE);
+	dst->flags |= CANXL_SEC;
+	dst->len = len + LLC_613_3_SIZE;
+
+	llc->pci = pci;
+	llc->res = 0;
+
+	/* update FCNT */
+	(*fcnt)++;
+	*fcnt &= 0xFFFFU;
+	llc->fcnt = htons(*fcnt); /* network byte order */
+}
+
+static inline __attribute__((always_inline))
+void frag_hdr_k(struct xlfrag_hdr *hdr, const struct canxl_frame *src,
+		__u8 pci, unsigned int len, unsigned int *fcnt)
+{
+	/* CAN XL header w/o data with segmentation bit */
+	memcpy(hdr, src, CANXL_HDR_SIZE);
+	hdr->flags |= CANXL_SEC;
+	hdr->len = len + LLC_613_3_SIZE;
+
+	hdr->llc.pci = pci;
+	hdr->llc.res = 0;
+
+	/* update FCNT */
+	(*fcnt)++;
+	*fcnt &= 0xFFFFU;
+	hdr->llc.fcnt = htons(*fcnt); /* network byte order */
+}
+
+static inline __u8 frag_tx_pci(const struct canxl_frame *src)
+{
+	/* set protocol version number and AOT to tx_pci */
+	__u8 tx_pci = CIA_613_3_VERSION | CIA_613_3_AOT;
+
+	/* save original SEC bit for DLX (further SEC handling) */
+	if (src->flags & CANXL_SEC)
+		tx_pci |= PCI_SECN;
+
+	return tx_pci;
+}
+
+static inline __attribute__((always_inline))
+unsigned int frag_pdu_k(const struct canxl_frame *src, const unsigned int sz,
+			unsigned int *fcnt, struct canxl_frame *dst)
+{
+	__u8 tx_pci = frag_tx_pci(src);
+	unsigned int nfrags, i;
+
+	if (!src->len)
+		return 0;
+
+	nfrags = (src->len + sz - 1) / sz;
+
+	/* FF / CF */
+	for (i = 0; i < nfrags - 1; i++) {
+		frag_frame_k(&dst[i], src, i ? tx_pci : tx_pci | PCI_FF,
+			     sz, fcnt);
+		copy_k(&dst[i].data[LLC_613_3_SIZE], &src->data[i * sz], sz);
+	}
+
+	/* last frame */
+	frag_frame_k(&dst[i], src, tx_pci | PCI_LF, src->len - i * sz, fcnt);
+	memcpy(&dst[i].data[LLC_613_3_SIZE], &src->data[i * sz],
+	       src->len - i * sz);
+
+	return nfrags;
+}
+
+static inline __attribute__((always_inline))
+unsigned int frag_pdu_hdr_k(const struct canxl_frame *src,
+			    const unsigned int sz, unsigned int *fcnt,
+			    struct xlfrag_hdr *hdr)
+{
+	__u8 tx_pci = frag_tx_pci(src);
+	unsigned int nfrags, i;
+
+	if (!src->len)
+		return 0;
+
+	nfrags = (src->len + sz - 1) / sz;
+
+	/* FF / CF */
+	for (i = 0; i < nfrags - 1; i++)
+		frag_hdr_k(&hdr[i], src, i ? tx_pci : tx_pci | PCI_FF,
+			   sz, fcnt);
+
+	/* last frame */
+	frag_hdr_k(&hdr[i], src, tx_pci | PCI_LF, src->len - i * sz, fcnt);
+
+	return nfrags;
+}
+
+/* CF with the fragment size of the FF (FCNT is already checked) */
+static inline __attribute__((always_inline))
+int join_cf_k(struct cia613_rx *rx, struct canxl_frame *pdu,
+	      const struct canxl_frame *cf, const unsigned int sz)
+{
+	/* make sure the data fits into the unfragmented frame */
+	if (rx->dataptr + sz > CANXL_MAX_DLEN)
+		return CIA613_E_OVERFLOW;
+
+	/* copy CAN XL fragment data w/o LLC information */
+	copy_k(&pdu->data[rx->dataptr], &cf->data[LLC_613_3_SIZE], sz);
+
+	/* update data pointer and length for next fragment data */
+	rx->dataptr += sz;
+	pdu->len = rx->dataptr;
+
+	return CIA613_OK;
+}
+
+#define CIA613_KERNELS(sz)						\
+static unsigned int frag_pdu_##sz(const struct canxl_frame *src,	\
+				  unsigned int *fcnt,			\
+				  struct canxl_frame *dst)		\
+{									\
+	return frag_pdu_k(src, sz, fcnt, dst);				\
+}									\
+static unsigned int frag_pdu_hdr_##sz(const struct canxl_frame *src,	\
+				      unsigned int *fcnt,		\
+				      struct xlfrag_hdr *hdr)		\
+{									\
+	return frag_pdu_hdr_k(src, sz, fcnt, hdr);			\
+}									\
+static int join_cf_##sz(struct cia613_rx *rx, struct canxl_frame *pdu,	\
+			const struct canxl_frame *cf)			\
+{									\
+	return join_cf_k(rx, pdu, cf, sz);				\
+}
+
+CIA613_KERNELS(128)
+CIA613_KERNELS(256)
+CIA613_KERNELS(384)
+CIA613_KERNELS(512)
+CIA613_KERNELS(640)
+CIA613_KERNELS(768)
+CIA613_KERNELS(896)
+CIA613_KERNELS(1024)
+
+_Static_assert(CIA613_FRAGSZ_NUM == 8,
+	       "kernels need to be instantiated for each legal fragment size");
+
+static unsigned int (*const frag_pdu_kernel[CIA613_FRAGSZ_NUM])
+	(const struct canxl_frame *, unsigned int *, struct canxl_frame *) = {
+	frag_pdu_128, frag_pdu_256, frag_pdu_384, frag_pdu_512,
+	frag_pdu_640, frag_pdu_768, frag_pdu_896, frag_pdu_1024,
+};
+
+static unsigned int (*const frag_pdu_hdr_kernel[CIA613_FRAGSZ_NUM])
+	(const struct canxl_frame *, unsigned int *, struct xlfrag_hdr *) = {
+	frag_pdu_hdr_128, frag_pdu_hdr_256, frag_pdu_hdr_384, frag_pdu_hdr_512,
+	frag_pdu_hdr_640, frag_pdu_hdr_768, frag_pdu_hdr_896, frag_pdu_hdr_1024,
+};
+
+static const cia613_cf_kernel join_cf_kernel[CIA613_FRAGSZ_NUM] = {
+	join_cf_128, join_cf_256, join_cf_384, join_cf_512,
+	join_cf_640, join_cf_768, join_cf_896, join_cf_1024,
+};
+
+unsigned int frag_pdu(const struct canxl_frame *src, unsigned int fragsz,
+		      unsigned int *fcnt, struct canxl_frame *dst)
+{
+	/* other fragment sizes could exceed dst[CIA613_MAX_FRAGS] */
+	if (cia613_fragsz_check(CIA613_FF, fragsz) != CIA613_OK)
+		return 0;
+
+	return frag_pdu_kernel[fragsz_idx(fragsz)](src, fcnt, dst);
+}
+
+unsigned int frag_pdu_hdr(const struct canxl_frame *src, unsigned int fragsz,
+			  unsigned int *fcnt, struct xlfrag_hdr *hdr)
+{
+	/* other fragment sizes could exceed hdr[CIA613_MAX_FRAGS] */
+	if (cia613_fragsz_check(CIA613_FF, fragsz) != CIA613_OK)
+		return 0;
+
+	return frag_pdu_hdr_kernel[fragsz_idx(fragsz)](src, fcnt, hdr);
+}
+
+void join_reset(struct cia613_rx *rx)
+{
+	rx->fcnt = CIA613_NO_FCNT;
+	rx->dataptr = 0;
+	rx->fragsz = 0;
+	rx->cf_kernel = NULL;
+}
+
+unsigned int join_next_fcnt(const struct cia613_rx *rx)
+{
+	if (!rx || rx->fcnt == CIA613_NO_FCNT)
+		return CIA613_NO_FCNT;
+
+	return (rx->fcnt + 1) & 0xFFFFU;
+}
+
+int join_push_generic(struct cia613_rx *rx, struct canxl_frame *pdu,
+		      const struct canxl_frame *cf)
+{
+	const struct llc_613_3 *llc = (const struct llc_613_3 *) cf->data;
+	unsigned int rxfcnt = ntohs(llc->fcnt); /* read with byte order */
+	unsigned int rxfragsz = cf->len - LLC_613_3_SIZE;
+	int type = cia613_frame_type(cf);
+	int ret;
+
+	if (type == CIA613_FF) {
+		ret = cia613_fragsz_check(type, rxfragsz);
+		if (ret)
+			return ret;
+
+		/* take current rxfcnt as initial fcnt */
+		rx->fcnt = rxfcnt;
+
+		/* copy CAN XL header w/o data */
+		memcpy(pdu, cf, CANXL_HDR_SIZE);
+
+		/* clear SEC bit from our segmentation process */
+		pdu->flags &= ~CANXL_SEC;
+
+		/* restore original SEC bit from DLX (for other AOT) */
+		if (llc->pci & PCI_SECN)
+			pdu->flags |= CANXL_SEC;
+
+		/* copy CAN XL fragment data w/o LLC information */
+		memcpy(&pdu->data[0], &cf->data[LLC_613_3_SIZE], rxfragsz);
+
+		/* 'reassembled' length without the LLC information */
+		rx->dataptr = rxfragsz;
+		pdu->len = rxfragsz;
+
+		/* select the CF kernel for this fragment size */
+		rx->fragsz = rxfragsz;
+		rx->cf_kernel = join_cf_kernel[fragsz_idx(rxfragsz)];
+
+		return CIA613_OK;
+	}
+
+	if (type != CIA613_CF && type != CIA613_LF)
+		return CIA613_E_TYPE;
+
+	/* check that rxfcnt has increased */
+	if (join_next_fcnt(rx) != rxfcnt) {
+		/* only FF can set a proper fcnt value */
+		if (rx)
+			join_reset(rx);
+		return CIA613_E_FCNT;
+	}
+	rx->fcnt = rxfcnt;
+
+	ret = cia613_fragsz_check(type, rxfragsz);
+	if (ret)
+		return ret;
+
+	/* make sure the data fits into the unfragmented frame */
+	if (rx->dataptr + rxfragsz > CANXL_MAX_DLEN)
+		return CIA613_E_OVERFLOW;
+
+	/* copy CAN XL fragment data w/o LLC information */
+	memcpy(&pdu->data[rx->dataptr], &cf->data[LLC_613_3_SIZE], rxfragsz);
+
+	/* update data pointer and length for next fragment data */
+	rx->dataptr += rxfragsz;
+	pdu->len = rx->dataptr;
+
+	if (type == CIA613_CF)
+		return CIA613_OK;
+
+	/* only FF can set a proper fcnt value */
+	join_reset(rx);
+
+	return CIA613_DONE;
+}
+
+int join_push(struct cia613_rx *rx, struct canxl_frame *pdu,
+	      const struct canxl_frame *cf)
+{
+	const struct llc_613_3 *llc = (const struct llc_613_3 *) cf->data;
+
+	/* fast path: CF with the FF fragment size and the expected FCNT */
+	if (rx && rx->cf_kernel &&
+	    cf->len - LLC_613_3_SIZE == rx->fragsz &&
+	    cia613_frame_type(cf) == CIA613_CF &&
+	    join_next_fcnt(rx) == ntohs(llc->fcnt)) {
+		rx->fcnt = ntohs(llc->fcnt);
+		return rx->cf_kernel(rx, pdu, cf);
+	}
+
+	return join_push_generic(rx, pdu, cf);
+}
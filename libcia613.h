@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * libcia613.h - CAN CiA 613-3 fragmentation/reassembly engine
+ *
+ * The functions operate on caller owned CAN XL frame buffers only.
+ * They do not perform syscalls or memory allocations and they do not
+ * print anything, so they can be embedded into other gateways.
+ *
+ */
+
+#ifndef LIBCIA613_H
+#define LIBCIA613_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include <linux/can.h>
+#include "cia-613-3.h"
+
+/* FCNT value of a reassembly context without ongoing transfer */
+#define CIA613_NO_FCNT 0x0FFF0000U
+
+/* max. number of fragments of a CAN XL frame */
+#define CIA613_MAX_FRAGS (CANXL_MAX_DLEN / MIN_FRAG_SIZE)
+
+/* number of legal fragment sizes (128 .. 1024 in 128 byte steps) */
+#define CIA613_FRAGSZ_NUM (MAX_FRAG_SIZE / FRAG_STEP_SIZE)
+
+/* CAN XL header and LLC information of a zero-copy fragment */
+struct xlfrag_hdr {
+	canid_t prio;
+	__u8 flags;
+	__u8 sdt;
+	__u16 len;
+	__u32 af;
+	struct llc_613_3 llc;
+};
+
+/* fragmentation state of a source frame */
+struct cia613_frag {
+	const struct canxl_frame *src;
+	unsigned int *fcnt; /* FCNT counter of the (TID, VCID) tuple */
+	unsigned int fragsz;
+	unsigned int dataptr;
+	__u8 tx_pci;
+};
+
+struct cia613_rx;
+
+/* CF reassembly kernel for the fragment size of the FF */
+typedef int (*cia613_cf_kernel)(struct cia613_rx *rx, struct canxl_frame *pdu,
+				const struct canxl_frame *cf);
+
+/* reassembly state of a (TID, VCID) tuple */
+struct cia613_rx {
+	unsigned int fcnt; /* FCNT of the last fragment or CIA613_NO_FCNT */
+	unsigned int dataptr; /* reassembled PDU length so far */
+	unsigned int fragsz; /* fragment size of the FF */
+	cia613_cf_kernel cf_kernel; /* selected with the FF */
+};
+
+/* frame types of cia613_frame_type() */
+enum {
+	CIA613_NOFRAG,	/* no CiA 613-3 fragment (SEC/AOT) */
+	CIA613_BADVER,	/* wrong CiA 613-3 protocol version */
+	CIA613_FF,	/* first frame */
+	CIA613_CF,	/* consecutive frame */
+	CIA613_LF,	/* last frame */
+	CIA613_RESERVED, /* reserved FF/LF combination */
+};
+
+/* return values of join_push() and cia613_fragsz_check() */
+enum {
+	CIA613_OK = 0,		/* fragment added to the PDU */
+	CIA613_DONE = 1,	/* PDU completely reassembled */
+	CIA613_E_SIZE = -1,	/* illegal fragment size */
+	CIA613_E_STEP = -2,	/* illegal fragment step size */
+	CIA613_E_FCNT = -3,	/* wrong FCNT => transfer aborted */
+	CIA613_E_OVERFLOW = -4,	/* PDU size overflow */
+	CIA613_E_TYPE = -5,	/* no FF/CF/LF frame */
+};
+
+/* classify a received CAN XL frame */
+int cia613_frame_type(const struct canxl_frame *cf);
+
+/* check the fragment size rules for the frame type (FF/CF/LF) */
+int cia613_fragsz_check(int type, unsigned int fragsz);
+
+/* start the fragmentation of src with the given FCNT counter */
+void frag_init(struct cia613_frag *f, const struct canxl_frame *src,
+	       unsigned int fragsz, unsigned int *fcnt);
+
+/*
+ * create the next fragment of the source frame in dst
+ *
+ * returns the CAN XL frame size to be sent (CANXL_HDR_SIZE + dst->len)
+ * or 0 when all fragments have been created
+ */
+unsigned int frag_next(struct cia613_frag *f, struct canxl_frame *dst);
+
+/*
+ * zero-copy variant of frag_next(): only the CAN XL header and the LLC
+ * information are created in hdr while *data points to the fragment
+ * data inside the source frame
+ *
+ * returns the fragment data length or 0 when all fragments are created
+ */
+unsigned int frag_next_hdr(struct cia613_frag *f, struct xlfrag_hdr *hdr,
+			   const __u8 **data);
+
+/*
+ * create all fragments of the source frame in dst[CIA613_MAX_FRAGS]
+ *
+ * Uses a kernel which is specialized at compile time for each legal
+ * fragment size. The kernel is selected once per PDU.
+ *
+ * returns the number of fragments or 0 when fragsz is no legal FF
+ * fragment size (see cia613_fragsz_check()) - use frag_init() and
+ * frag_next() for other fragment sizes
+ */
+unsigned int frag_pdu(const struct canxl_frame *src, unsigned int fragsz,
+		      unsigned int *fcnt, struct canxl_frame *dst);
+
+/*
+ * zero-copy variant of frag_pdu(): only the CAN XL header and the LLC
+ * information are created in hdr[CIA613_MAX_FRAGS]. The data of the
+ * fragment n starts at src->data[n * fragsz] with hdr[n].len minus
+ * LLC_613_3_SIZE bytes.
+ *
+ * returns the number of fragments or 0 when fragsz is no legal FF
+ * fragment size (like frag_pdu())
+ */
+unsigned int frag_pdu_hdr(const struct canxl_frame *src, unsigned int fragsz,
+			  unsigned int *fcnt, struct xlfrag_hdr *hdr);
+
+/* reset the reassembly state (no ongoing transfer) */
+void join_reset(struct cia613_rx *rx);
+
+/* FCNT value expected for the next CF/LF (or CIA613_NO_FCNT) */
+unsigned int join_next_fcnt(const struct cia613_rx *rx);
+
+/*
+ * add the fragment cf to the PDU in pdu (reassembly state rx)
+ *
+ * FF restarts the reassembly. For CF/LF without ongoing transfer rx may
+ * be NULL. A wrong FCNT aborts the transfer. On CIA613_DONE pdu contains
+ * the reassembled PDU and the state is reset.
+ *
+ * returns CIA613_OK, CIA613_DONE or a negative CIA613_E_* value
+ */
+int join_push(struct cia613_rx *rx, struct canxl_frame *pdu,
+	      const struct canxl_frame *cf);
+
+/* join_push() without the fragment size specific CF kernels (reference) */
+int join_push_generic(struct cia613_rx *rx, struct canxl_frame *pdu,
+		      const struct canxl_frame *cf);
+
+#endif /* LIBCIA613_H */
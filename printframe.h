@@ -1,70 +1,237 @@
+#ifndef PRINTFRAME_H
+#define PRINTFRAME_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <linux/can.h>
 
-static inline void printxlframe(struct canxl_frame *cfx)
+/*
+ * The frames are formatted with a hex table into a line buffer which is
+ * written to stdout with fwrite(). By default stdout is flushed after
+ * each frame. After printframe_setbuf() stdout is fully buffered and
+ * flushed when the buffer is full or PRINTFRAME_FLUSH_MS after the last
+ * flush (the caller should fflush(stdout) before waiting for frames).
+ */
+
+#define PRINTFRAME_BUFSZ (1 << 20)
+#define PRINTFRAME_FLUSH_MS 100
+
+/* default number of printed CAN XL data bytes */
+#define PRINTFRAME_XLDATA 12
+
+/* max. CAN XL line: header, 2048 data bytes with '.' separators, length */
+#define PRINTFRAME_STRLEN (2 + 3 + 1 + 2 + 1 + 2 + 1 + 8 + 1 + \
+			   2 * CANXL_MAX_DLEN + CANXL_MAX_DLEN / 4 + 7 + 1)
+
+#define PRINTFRAME_HEX16(h) \
+	h"0" h"1" h"2" h"3" h"4" h"5" h"6" h"7" \
+	h"8" h"9" h"A" h"B" h"C" h"D" h"E" h"F"
+
+/* two upper case hex digits for each byte value */
+static const char printframe_hex[] =
+	PRINTFRAME_HEX16("0") PRINTFRAME_HEX16("1") PRINTFRAME_HEX16("2")
+	PRINTFRAME_HEX16("3") PRINTFRAME_HEX16("4") PRINTFRAME_HEX16("5")
+	PRINTFRAME_HEX16("6") PRINTFRAME_HEX16("7") PRINTFRAME_HEX16("8")
+	PRINTFRAME_HEX16("9") PRINTFRAME_HEX16("A") PRINTFRAME_HEX16("B")
+	PRINTFRAME_HEX16("C") PRINTFRAME_HEX16("D") PRINTFRAME_HEX16("E")
+	PRINTFRAME_HEX16("F");
+
+static unsigned int printframe_xldata = PRINTFRAME_XLDATA;
+static int printframe_buffered;
+static struct timespec printframe_flushed;
+
+/* print all CAN XL data bytes instead of the first PRINTFRAME_XLDATA */
+static inline void printframe_fullxl(void)
 {
-	int i;
+	printframe_xldata = CANXL_MAX_DLEN;
+}
 
-	/* print prio and CAN XL header content */
-	printf("%02X%03X#%02X:%02X:%08X#",
-	       (canid_t)(cfx->prio & CANXL_VCID_MASK) >> CANXL_VCID_OFFSET,
-	       (canid_t)(cfx->prio & CANXL_PRIO_MASK),
-	       cfx->flags, cfx->sdt, cfx->af);
+/* switch stdout to a large buffer which is flushed by size or time */
+static inline void printframe_setbuf(void)
+{
+	setvbuf(stdout, NULL, _IOFBF, PRINTFRAME_BUFSZ);
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &printframe_flushed);
+	printframe_buffered = 1;
+}
 
-	/* print up to 12 data bytes */
-	for (i = 0; i < cfx->len && i < 12; i++) {
-		if (!(i%4) && i)
-			printf(".");
-		printf("%02X", cfx->data[i]);
+static inline void printframe_flush(void)
+{
+	struct timespec now;
+
+	if (!printframe_buffered) {
+		fflush(stdout);
+		return;
 	}
 
-	/* print CAN XL data length */
-	printf("(%d)\n", cfx->len);
-	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	if ((now.tv_sec - printframe_flushed.tv_sec) * 1000 +
+	    (now.tv_nsec - printframe_flushed.tv_nsec) / 1000000 >=
+	    PRINTFRAME_FLUSH_MS) {
+		fflush(stdout);
+		printframe_flushed = now;
+	}
 }
 
-static inline void printfdframe(struct canfd_frame *cfd)
+static inline char *printframe_byte(char *s, __u8 val)
 {
-	int i;
+	memcpy(s, &printframe_hex[val * 2], 2);
+	return s + 2;
+}
 
-	if (cfd->can_id & CAN_EFF_FLAG)
-		printf("%08X#", cfd->can_id & CAN_EFF_MASK);
-	else
-		printf("%03X#", cfd->can_id & CAN_SFF_MASK);
+static inline char *printframe_data(char *s, const __u8 *data,
+				    unsigned int len)
+{
+	unsigned int i;
 
-	printf("#%X", cfd->flags & 0xF);
+	for (i = 0; i < len; i++)
+		s = printframe_byte(s, data[i]);
+	return s;
+}
 
-	for (i = 0; i < cfd->len; i++)
-		printf("%02X", cfd->data[i]);
+/* upper case hex value with a fixed number of digits */
+static inline char *printframe_hexval(char *s, unsigned long val,
+				      unsigned int digits)
+{
+	unsigned int i;
 
-	printf("\n");
-	fflush(stdout);
+	for (i = digits; i > 0; i--) {
+		s[i - 1] = printframe_hex[(val & 0xF) * 2 + 1];
+		val >>= 4;
+	}
+	return s + digits;
 }
 
-static inline void printccframe(struct can_frame *cf)
+static inline char *printframe_dec(char *s, unsigned int val)
 {
-	int i;
+	char tmp[10];
+	unsigned int n = 0;
 
-	if (cf->can_id & CAN_EFF_FLAG)
-		printf("%08X#", cf->can_id & CAN_EFF_MASK);
+	do {
+		tmp[n++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	while (n)
+		*s++ = tmp[--n];
+	return s;
+}
+
+static inline char *printframe_id(char *s, canid_t can_id)
+{
+	if (can_id & CAN_EFF_FLAG)
+		s = printframe_hexval(s, can_id & CAN_EFF_MASK, 8);
 	else
-		printf("%03X#", cf->can_id & CAN_SFF_MASK);
+		s = printframe_hexval(s, can_id & CAN_SFF_MASK, 3);
+	*s++ = '#';
+
+	return s;
+}
+
+/* format a CAN XL frame line into buf - returns the length */
+static inline int sprintxlframe(char *buf, const struct canxl_frame *cfx)
+{
+	unsigned int len = cfx->len, i;
+	char *s = buf;
+
+	if (len > CANXL_MAX_DLEN)
+		len = CANXL_MAX_DLEN;
+
+	/* prio and CAN XL header content */
+	s = printframe_byte(s, (cfx->prio & CANXL_VCID_MASK) >> CANXL_VCID_OFFSET);
+	s = printframe_hexval(s, cfx->prio & CANXL_PRIO_MASK, 3);
+	*s++ = '#';
+	s = printframe_byte(s, cfx->flags);
+	*s++ = ':';
+	s = printframe_byte(s, cfx->sdt);
+	*s++ = ':';
+	s = printframe_hexval(s, cfx->af, 8);
+	*s++ = '#';
+
+	/* up to printframe_xldata data bytes in groups of four */
+	for (i = 0; i < len && i < printframe_xldata; i++) {
+		if (!(i%4) && i)
+			*s++ = '.';
+		s = printframe_byte(s, cfx->data[i]);
+	}
+
+	/* CAN XL data length */
+	*s++ = '(';
+	s = printframe_dec(s, cfx->len);
+	*s++ = ')';
+	*s++ = '\n';
+
+	return s - buf;
+}
+
+static inline int sprintfdframe(char *buf, const struct canfd_frame *cfd)
+{
+	unsigned int len = cfd->len;
+	char *s = buf;
+
+	if (len > CANFD_MAX_DLEN)
+		len = CANFD_MAX_DLEN;
+
+	s = printframe_id(s, cfd->can_id);
+	*s++ = '#';
+	*s++ = printframe_hex[(cfd->flags & 0xF) * 2 + 1];
+	s = printframe_data(s, cfd->data, len);
+	*s++ = '\n';
+
+	return s - buf;
+}
+
+static inline int sprintccframe(char *buf, const struct can_frame *cf)
+{
+	unsigned int len = cf->len;
+	char *s = buf;
+
+	if (len > CAN_MAX_DLEN)
+		len = CAN_MAX_DLEN;
+
+	s = printframe_id(s, cf->can_id);
 
 	if (cf->can_id & CAN_RTR_FLAG) {
-		printf("R");
+		*s++ = 'R';
 		if (cf->len > 0)
-			printf("%d", cf->len);
+			s = printframe_dec(s, cf->len);
 	} else {
-		for (i = 0; i < cf->len; i++)
-			printf("%02X", cf->data[i]);
+		s = printframe_data(s, cf->data, len);
 	}
 	if (cf->len == CAN_MAX_DLEN &&
 	    cf->len8_dlc > CAN_MAX_DLEN &&
-	    cf->len8_dlc <= CAN_MAX_RAW_DLC)
-		printf("_%X", cf->len8_dlc);
+	    cf->len8_dlc <= CAN_MAX_RAW_DLC) {
+		*s++ = '_';
+		*s++ = printframe_hex[cf->len8_dlc * 2 + 1];
+	}
+	*s++ = '\n';
 
-	printf("\n");
-	fflush(stdout);
+	return s - buf;
 }
+
+static inline void printxlframe(struct canxl_frame *cfx)
+{
+	char buf[PRINTFRAME_STRLEN];
+
+	fwrite(buf, 1, sprintxlframe(buf, cfx), stdout);
+	printframe_flush();
+}
+
+static inline void printfdframe(struct canfd_frame *cfd)
+{
+	char buf[PRINTFRAME_STRLEN];
+
+	fwrite(buf, 1, sprintfdframe(buf, cfd), stdout);
+	printframe_flush();
+}
+
+static inline void printccframe(struct can_frame *cf)
+{
+	char buf[PRINTFRAME_STRLEN];
+
+	fwrite(buf, 1, sprintccframe(buf, cf), stdout);
+	printframe_flush();
+}
+
+#endif /* PRINTFRAME_H */
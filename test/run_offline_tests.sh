@@ -0,0 +1,85 @@
+#!/bin/bash
+
+# offline regression test of the testcases without vcan interfaces
+#
+# the testcase logs are read by cia613check and cia613join in their
+# offline log mode (-r) and the state notifications / joined frames are
+# compared with the golden output in golden/testcase_<n>.{check,join}
+# and the cia613check summary report in golden/testcase_<n>.summary
+#
+# the testcases are also converted into binary captures with canxlcap
+# and the output from the binary captures has to match the same golden
+# output
+#
+# 'UPDATE=1 ./run_offline_tests.sh' (re)creates the golden output
+
+cd "$(dirname "$0")" || exit 1
+
+CIA613CHECK=../cia613check
+CIA613JOIN=../cia613join
+CANXLCAP=../canxlcap
+GOLDEN=golden
+
+# all transfer IDs of the testcases and buffers like cia613check
+TIDS=001,003,008,011,021,031
+MAXBUFFS=3
+
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf $OUT' EXIT
+
+FAILED=0
+
+for LOG in testcase_*.log; do
+    TC=${LOG%.log}
+
+    # LowPrioCounter only for testcase 11 (see README.LowPrioCounter)
+    if [ $TC = testcase_11 ]; then
+	CHECKOPTS=
+	JOINOPTS="-c $MAXBUFFS"
+    else
+	CHECKOPTS="-l 10"
+	JOINOPTS="-c $MAXBUFFS -l 0"
+    fi
+
+    $CIA613CHECK $CHECKOPTS -s -r $LOG vcanxl0 > $OUT/$TC.check \
+		2> $OUT/$TC.summary
+    $CIA613JOIN -t $TIDS $JOINOPTS -r $LOG vcanxl0 vcanxl1 \
+		> $OUT/$TC.join 2> /dev/null
+
+    for EXT in check summary join; do
+	if [ -n "$UPDATE" ]; then
+	    cp $OUT/$TC.$EXT $GOLDEN/$TC.$EXT
+	elif ! diff -u $GOLDEN/$TC.$EXT $OUT/$TC.$EXT; then
+	    echo "$TC ($EXT): FAILED"
+	    FAILED=$((FAILED + 1))
+	fi
+    done
+
+    [ -n "$UPDATE" ] && continue
+
+    # same testcase from a binary capture
+    $CANXLCAP -b $LOG $OUT/$TC.xlcap
+    $CIA613CHECK $CHECKOPTS -s -r $OUT/$TC.xlcap vcanxl0 > $OUT/$TC.check \
+		2> $OUT/$TC.summary
+    $CIA613JOIN -t $TIDS $JOINOPTS -r $OUT/$TC.xlcap vcanxl0 vcanxl1 \
+		> $OUT/$TC.join 2> /dev/null
+
+    for EXT in check summary join; do
+	if ! diff -u $GOLDEN/$TC.$EXT $OUT/$TC.$EXT; then
+	    echo "$TC ($EXT, binary capture): FAILED"
+	    FAILED=$((FAILED + 1))
+	fi
+    done
+done
+
+if [ -n "$UPDATE" ]; then
+    echo "golden output updated"
+    exit 0
+fi
+
+if [ $FAILED -ne 0 ]; then
+    echo "$FAILED offline test(s) FAILED"
+    exit 1
+fi
+
+echo "all offline tests passed"
@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * uring.h - minimal io_uring helpers (no liburing dependency)
+ *
+ * provides the ring setup, SQE/CQE handling and a provided buffer ring
+ * for multishot receive operations.
+ *
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail; /* prepared but not yet submitted SQEs */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+struct uring_bufring {
+	struct io_uring_buf_ring *br;
+	unsigned int entries;
+	unsigned short tail;
+};
+
+static inline int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(int fd, unsigned int to_submit,
+			      unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static inline int uring_register(int fd, unsigned int opcode, void *arg,
+				 unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* returns 0 on success or -errno (e.g. -ENOSYS without io_uring) */
+static inline int uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_sz, cq_sz;
+	char *sq_ptr, *cq_ptr;
+
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+
+	r->fd = uring_setup(entries, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_sz > sq_sz)
+			sq_sz = cq_sz;
+		cq_sz = sq_sz;
+	}
+
+	sq_ptr = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, r->fd,
+			      IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			goto err;
+	}
+
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto err;
+
+	r->sq_head = (unsigned int *)(sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq_ptr + p.sq_off.array);
+	r->sq_entries = p.sq_entries;
+	r->sq_local_tail = *r->sq_tail;
+
+	r->cq_head = (unsigned int *)(cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+	return 0;
+
+err:
+	close(r->fd);
+	return -errno;
+}
+
+/* number of SQEs that can still be prepared */
+static inline unsigned int uring_sq_space(struct uring *r)
+{
+	return r->sq_entries -
+		(r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/* returns a zeroed SQE or NULL when the submission queue is full */
+static inline struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if (!uring_sq_space(r))
+		return NULL;
+
+	idx = r->sq_local_tail & *r->sq_mask;
+	r->sq_array[idx] = idx;
+	r->sq_local_tail++;
+
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+/* submit all prepared SQEs and wait for at least wait_nr completions */
+static inline int uring_submit_and_wait(struct uring *r, unsigned int wait_nr)
+{
+	unsigned int to_submit = r->sq_local_tail - *r->sq_tail;
+	int ret;
+
+	__atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+
+	ret = uring_enter(r->fd, to_submit, wait_nr,
+			  wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+/* returns the next completion or NULL - release it with uring_cqe_seen() */
+static inline struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+	unsigned int head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->cqes[head & *r->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *r)
+{
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* register a provided buffer ring with 'entries' (power of 2) buffers */
+static inline int uring_bufring_init(struct uring *r, struct uring_bufring *b,
+				     unsigned int entries, unsigned short bgid)
+{
+	struct io_uring_buf_reg reg;
+	void *mem;
+	int ret;
+
+	ret = posix_memalign(&mem, sysconf(_SC_PAGESIZE),
+			     entries * sizeof(struct io_uring_buf));
+	if (ret)
+		return -ret;
+
+	memset(mem, 0, entries * sizeof(struct io_uring_buf));
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)mem;
+	reg.ring_entries = entries;
+	reg.bgid = bgid;
+
+	if (uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		ret = -errno;
+		free(mem);
+		return ret;
+	}
+
+	b->br = mem;
+	b->entries = entries;
+	b->tail = 0;
+
+	return 0;
+}
+
+/* hand a buffer (back) to the kernel */
+static inline void uring_buf_add(struct uring_bufring *b, void *addr,
+				 unsigned int len, unsigned short bid)
+{
+	struct io_uring_buf *buf = &b->br->bufs[b->tail & (b->entries - 1)];
+
+	buf->addr = (unsigned long)addr;
+	buf->len = len;
+	buf->bid = bid;
+	b->tail++;
+
+	__atomic_store_n(&b->br->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+#endif /* URING_H */
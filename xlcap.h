@@ -0,0 +1,617 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * xlcap.h - compact binary capture format for CAN CC/FD/XL frames
+ *
+ * The capture is a file header followed by blocks. An interface block
+ * assigns the next interface index (0, 1, ...) to an interface name
+ * and a frame block contains a sequence of records:
+ *
+ *   struct xlcap_rec (12 bytes) + frame content, padded to 4 bytes
+ *
+ * Only the used part of the frame is stored: the 8 byte CAN CC/FD
+ * header or the 12 byte CAN XL header and the len data bytes. So a
+ * CAN XL frame with 2048 data bytes takes 2072 bytes instead of the
+ * 4 KB of its candump text line.
+ *
+ * Frame blocks can be compressed (make ZLIB=1). Uncompressed blocks are
+ * iterated in place in the mapped file, compressed blocks are inflated
+ * once into a block buffer. The frame content is never copied by the
+ * reader: xlcap_next() returns the record inside the mapping/buffer.
+ *
+ * All values are in host byte order. A capture from a host with the
+ * other byte order is detected by the byte swapped magic and rejected
+ * with ENOEXEC (like a binary of a foreign architecture) instead of
+ * being parsed as candump text.
+ *
+ */
+
+#ifndef XLCAP_H
+#define XLCAP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#define XLCAP_MAGIC 0x50414358 /* 'XCAP' */
+#define XLCAP_MAGIC_SWAPPED __builtin_bswap32(XLCAP_MAGIC) /* other byte order */
+#define XLCAP_VERSION 1
+#define XLCAP_BLKSZ (1 << 18) /* max. uncompressed frame block payload */
+#define XLCAP_MAX_IFS 256
+#define XLCAP_FLUSH_MS 1000 /* max. age of a partially filled block */
+
+/* block types */
+#define XLCAP_BLK_IF		1 /* payload: interface name[IFNAMSIZ] */
+#define XLCAP_BLK_FRAMES	2 /* payload: frame records */
+
+/* block compression */
+#define XLCAP_COMP_NONE		0
+#define XLCAP_COMP_ZLIB		1
+
+/* frame types */
+#define XLCAP_CC		0
+#define XLCAP_FD		1
+#define XLCAP_XL		2
+
+/* stored header size of CAN CC/FD frames (before the data bytes) */
+#define XLCAP_CCFD_HDR offsetof(struct canfd_frame, data)
+
+#define XLCAP_ALIGN(len) (((len) + 3) & ~3U)
+
+struct xlcap_filehdr {
+	__u32 magic;
+	__u16 version;
+	__u16 res;
+	__u32 blksz; /* max. uncompressed block payload */
+	__u32 res2;
+};
+
+struct xlcap_blk {
+	__u16 type;
+	__u8 comp;
+	__u8 res;
+	__u32 len; /* stored payload length (without padding) */
+	__u32 rawlen; /* uncompressed payload length */
+	__u32 nrec;
+};
+
+struct xlcap_rec {
+	__u32 sec;
+	__u32 nsec;
+	__u16 len; /* stored frame content */
+	__u8 ifidx;
+	__u8 type;
+	__u8 frame[]; /* struct can_frame/canfd_frame/canxl_frame */
+};
+
+/* capture reader */
+struct xlcap {
+	const char *buf; /* mapped capture */
+	size_t size;
+	size_t pos; /* next block */
+	int mapped;
+
+	/* records of the current frame block */
+	const char *rec, *recend;
+
+	char *zbuf; /* inflated block */
+	char ifname[XLCAP_MAX_IFS][IFNAMSIZ];
+	unsigned int nifs;
+
+	const char *err; /* reason when xlcap_next() returned NULL */
+
+	/* statistics */
+	unsigned long long blocks, zblocks, rawbytes;
+};
+
+/* capture writer */
+struct xlcap_writer {
+	FILE *f;
+	int comp;
+	char *blk; /* frame block payload */
+	unsigned int used, nrec;
+	struct timespec start; /* first record of the block (monotonic) */
+	char *zbuf;
+
+	char ifname[XLCAP_MAX_IFS][IFNAMSIZ];
+	unsigned int nifs, last;
+
+	/* statistics */
+	unsigned long long frames, rawbytes, bytes;
+};
+
+static inline unsigned int xlcap_type2mtu(unsigned int type)
+{
+	static const unsigned int mtu[] = { CAN_MTU, CANFD_MTU, CANXL_MTU };
+
+	return mtu[type];
+}
+
+/* stored length of a frame with the given MTU */
+static inline unsigned int xlcap_framelen(const void *frame, unsigned int mtu)
+{
+	const struct can_frame *cf = frame;
+
+	if (mtu == CANXL_MTU)
+		return CANXL_HDR_SIZE + ((const struct canxl_frame *)frame)->len;
+
+	/* no data bytes in RTR frames */
+	if (mtu == CAN_MTU && cf->can_id & CAN_RTR_FLAG)
+		return XLCAP_CCFD_HDR;
+
+	return XLCAP_CCFD_HDR + cf->len;
+}
+
+/* check the frame content of a record - returns 0 when valid */
+static inline int xlcap_check_rec(const struct xlcap_rec *r)
+{
+	const struct canxl_frame *cfx = (const void *)r->frame;
+	const struct can_frame *cf = (const void *)r->frame;
+
+	switch (r->type) {
+	case XLCAP_XL:
+		return r->len < CANXL_HDR_SIZE + CANXL_MIN_DLEN ||
+			r->len > CANXL_MTU || r->len != CANXL_HDR_SIZE + cfx->len;
+	case XLCAP_FD:
+		return r->len < XLCAP_CCFD_HDR || cf->len > CANFD_MAX_DLEN ||
+			r->len != XLCAP_CCFD_HDR + cf->len;
+	case XLCAP_CC:
+		return r->len < XLCAP_CCFD_HDR || cf->len > CAN_MAX_DLEN ||
+			r->len != xlcap_framelen(cf, CAN_MTU);
+	}
+
+	return -1;
+}
+
+/* returns 1 when buf starts with a capture file header (any byte order) */
+static inline int xlcap_detect(const void *buf, size_t size)
+{
+	const struct xlcap_filehdr *fh = buf;
+
+	return size >= sizeof(*fh) &&
+		(fh->magic == XLCAP_MAGIC || fh->magic == XLCAP_MAGIC_SWAPPED);
+}
+
+/* use an already mapped capture - returns 0 or -1 with errno set */
+static inline int xlcap_attach(struct xlcap *cap, const void *buf, size_t size)
+{
+	const struct xlcap_filehdr *fh = buf;
+
+	memset(cap, 0, sizeof(*cap));
+
+	if (xlcap_detect(buf, size) && fh->magic == XLCAP_MAGIC_SWAPPED) {
+		errno = ENOEXEC;
+		return -1;
+	}
+
+	if (!xlcap_detect(buf, size) || fh->version != XLCAP_VERSION ||
+	    fh->blksz > XLCAP_BLKSZ) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cap->buf = buf;
+	cap->size = size;
+	cap->pos = sizeof(*fh);
+
+	return 0;
+}
+
+/* returns 0 on success or -1 with errno set */
+static inline int xlcap_open(struct xlcap *cap, const char *name)
+{
+	struct stat st;
+	void *buf;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (!st.st_size) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return -1;
+
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+	if (xlcap_attach(cap, buf, st.st_size) < 0) {
+		munmap(buf, st.st_size);
+		return -1;
+	}
+	cap->mapped = 1;
+
+	return 0;
+}
+
+static inline void xlcap_close(struct xlcap *cap)
+{
+	if (cap->mapped)
+		munmap((void *)cap->buf, cap->size);
+	free(cap->zbuf);
+	memset(cap, 0, sizeof(*cap));
+}
+
+/* restart at the first block */
+static inline void xlcap_rewind(struct xlcap *cap)
+{
+	cap->pos = sizeof(struct xlcap_filehdr);
+	cap->rec = cap->recend = NULL;
+	cap->nifs = 0;
+}
+
+/* load the next frame block - returns 1, 0 at the end or -1 on errors */
+static inline int xlcap_block(struct xlcap *cap)
+{
+	const struct xlcap_blk *b;
+	const char *payload;
+
+	while (cap->pos < cap->size) {
+		if (cap->size - cap->pos < sizeof(*b)) {
+			cap->err = "truncated block header";
+			return -1;
+		}
+
+		b = (const struct xlcap_blk *)(cap->buf + cap->pos);
+		payload = (const char *)(b + 1);
+		if (cap->size - cap->pos - sizeof(*b) < b->len) {
+			cap->err = "truncated block";
+			return -1;
+		}
+		cap->pos += sizeof(*b) + XLCAP_ALIGN(b->len);
+
+		if (b->type == XLCAP_BLK_IF) {
+			if (b->len != IFNAMSIZ || cap->nifs == XLCAP_MAX_IFS) {
+				cap->err = "bad interface block";
+				return -1;
+			}
+			memcpy(cap->ifname[cap->nifs], payload, IFNAMSIZ);
+			cap->ifname[cap->nifs++][IFNAMSIZ - 1] = 0;
+			continue;
+		}
+
+		/* skip unknown block types */
+		if (b->type != XLCAP_BLK_FRAMES)
+			continue;
+
+		if (b->rawlen > XLCAP_BLKSZ) {
+			cap->err = "oversized block";
+			return -1;
+		}
+
+		cap->blocks++;
+		cap->rawbytes += b->rawlen;
+
+		if (b->comp == XLCAP_COMP_NONE) {
+			if (b->rawlen != b->len) {
+				cap->err = "bad block length";
+				return -1;
+			}
+			cap->rec = payload;
+			cap->recend = payload + b->len;
+			return 1;
+		}
+
+#ifdef USE_ZLIB
+		if (b->comp == XLCAP_COMP_ZLIB) {
+			uLongf rawlen = b->rawlen;
+
+			if (!cap->zbuf) {
+				cap->zbuf = malloc(XLCAP_BLKSZ);
+				if (!cap->zbuf) {
+					cap->err = "out of memory";
+					return -1;
+				}
+			}
+
+			if (uncompress((Bytef *)cap->zbuf, &rawlen,
+				       (const Bytef *)payload, b->len) != Z_OK ||
+			    rawlen != b->rawlen) {
+				cap->err = "corrupt compressed block";
+				return -1;
+			}
+			cap->zblocks++;
+			cap->rec = cap->zbuf;
+			cap->recend = cap->zbuf + rawlen;
+			return 1;
+		}
+#endif
+		cap->err = "unsupported block compression (make ZLIB=1)";
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * next frame record of the capture (in place - no copy)
+ *
+ * returns NULL at the end of the capture or on errors (cap->err set)
+ */
+static inline const struct xlcap_rec *xlcap_next(struct xlcap *cap)
+{
+	const struct xlcap_rec *r;
+	int ret;
+
+	cap->err = NULL;
+
+	while (cap->rec == cap->recend) {
+		ret = xlcap_block(cap);
+		if (ret <= 0) {
+			/* no resync after a broken block */
+			if (ret < 0)
+				cap->pos = cap->size;
+			cap->rec = cap->recend = NULL;
+			return NULL;
+		}
+	}
+
+	r = (const struct xlcap_rec *)cap->rec;
+	if (cap->recend - cap->rec < (long)sizeof(*r) ||
+	    cap->recend - cap->rec < (long)(sizeof(*r) + r->len)) {
+		cap->err = "truncated record";
+		cap->rec = cap->recend = NULL;
+		return NULL;
+	}
+
+	if (r->ifidx >= cap->nifs || xlcap_check_rec(r)) {
+		cap->err = "malformed record";
+		cap->rec = cap->recend = NULL;
+		return NULL;
+	}
+
+	cap->rec += XLCAP_ALIGN(sizeof(*r) + r->len);
+	if (cap->rec > cap->recend)
+		cap->rec = cap->recend;
+
+	return r;
+}
+
+static inline const char *xlcap_ifname(const struct xlcap *cap,
+				       const struct xlcap_rec *r)
+{
+	return cap->ifname[r->ifidx];
+}
+
+static inline int xlcap_put(struct xlcap_writer *w, const void *data,
+			    size_t len)
+{
+	static const char pad[4];
+
+	if (fwrite(data, 1, len, w->f) != len)
+		return -1;
+	if (XLCAP_ALIGN(len) != len &&
+	    fwrite(pad, 1, XLCAP_ALIGN(len) - len, w->f) != XLCAP_ALIGN(len) - len)
+		return -1;
+
+	w->bytes += XLCAP_ALIGN(len);
+
+	return 0;
+}
+
+/*
+ * start a capture into f - comp: compress the frame blocks
+ *
+ * returns 0 on success or -1 with errno set
+ */
+static inline int xlcap_create(struct xlcap_writer *w, FILE *f, int comp)
+{
+	struct xlcap_filehdr fh = {
+		.magic = XLCAP_MAGIC,
+		.version = XLCAP_VERSION,
+		.blksz = XLCAP_BLKSZ,
+	};
+
+	memset(w, 0, sizeof(*w));
+	w->f = f;
+
+#ifdef USE_ZLIB
+	if (comp) {
+		w->zbuf = malloc(compressBound(XLCAP_BLKSZ));
+		if (!w->zbuf)
+			return -1;
+		w->comp = 1;
+	}
+#else
+	if (comp) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+#endif
+
+	w->blk = malloc(XLCAP_BLKSZ);
+	if (!w->blk) {
+		free(w->zbuf);
+		return -1;
+	}
+
+	w->bytes = sizeof(fh);
+	if (fwrite(&fh, 1, sizeof(fh), f) != sizeof(fh))
+		return -1;
+
+	return 0;
+}
+
+/* write the current frame block - returns 0 or -1 on write errors */
+static inline int xlcap_flush(struct xlcap_writer *w)
+{
+	struct xlcap_blk b = {
+		.type = XLCAP_BLK_FRAMES,
+		.len = w->used,
+		.rawlen = w->used,
+		.nrec = w->nrec,
+	};
+	const char *payload = w->blk;
+
+	if (!w->nrec)
+		return 0;
+
+#ifdef USE_ZLIB
+	if (w->comp) {
+		uLongf zlen = compressBound(XLCAP_BLKSZ);
+
+		/* keep incompressible blocks uncompressed */
+		if (compress2((Bytef *)w->zbuf, &zlen, (const Bytef *)w->blk,
+			      w->used, Z_BEST_SPEED) == Z_OK &&
+		    zlen < w->used) {
+			b.comp = XLCAP_COMP_ZLIB;
+			b.len = zlen;
+			payload = w->zbuf;
+		}
+	}
+#endif
+
+	w->rawbytes += w->used;
+	w->bytes += sizeof(b);
+	w->used = 0;
+	w->nrec = 0;
+
+	if (fwrite(&b, 1, sizeof(b), w->f) != sizeof(b))
+		return -1;
+
+	return xlcap_put(w, payload, b.len);
+}
+
+/* interface index of ifname (a new name is written as interface block) */
+static inline int xlcap_ifidx(struct xlcap_writer *w, const char *ifname)
+{
+	struct xlcap_blk b = {
+		.type = XLCAP_BLK_IF,
+		.len = IFNAMSIZ,
+		.rawlen = IFNAMSIZ,
+		.nrec = 1,
+	};
+	unsigned int i;
+
+	if (w->nifs && !strcmp(w->ifname[w->last], ifname))
+		return w->last;
+
+	for (i = 0; i < w->nifs; i++) {
+		if (!strcmp(w->ifname[i], ifname)) {
+			w->last = i;
+			return i;
+		}
+	}
+
+	if (w->nifs == XLCAP_MAX_IFS) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	/* the block precedes the (buffered) frame block using the index */
+	memcpy(w->ifname[w->nifs], ifname, strnlen(ifname, IFNAMSIZ - 1));
+	w->bytes += sizeof(b);
+	if (fwrite(&b, 1, sizeof(b), w->f) != sizeof(b) ||
+	    xlcap_put(w, w->ifname[w->nifs], IFNAMSIZ))
+		return -1;
+
+	w->last = w->nifs++;
+
+	return w->last;
+}
+
+/* append a frame - returns 0 or -1 with errno set */
+static inline int xlcap_write(struct xlcap_writer *w, const struct timespec *ts,
+			      const char *ifname, const void *frame,
+			      unsigned int mtu)
+{
+	struct xlcap_rec *r;
+	unsigned int len = xlcap_framelen(frame, mtu);
+	int ifidx;
+
+	ifidx = xlcap_ifidx(w, ifname);
+	if (ifidx < 0)
+		return -1;
+
+	if (w->used + XLCAP_ALIGN(sizeof(*r) + len) > XLCAP_BLKSZ &&
+	    xlcap_flush(w))
+		return -1;
+
+	if (!w->nrec)
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &w->start);
+
+	r = (struct xlcap_rec *)(w->blk + w->used);
+	r->sec = ts->tv_sec;
+	r->nsec = ts->tv_nsec;
+	r->len = len;
+	r->ifidx = ifidx;
+	r->type = (mtu == CANXL_MTU) ? XLCAP_XL :
+		(mtu == CANFD_MTU) ? XLCAP_FD : XLCAP_CC;
+	memcpy(r->frame, frame, len);
+
+	/* zero the padding for reproducible captures */
+	memset(r->frame + len, 0, XLCAP_ALIGN(sizeof(*r) + len) - sizeof(*r) - len);
+
+	w->used += XLCAP_ALIGN(sizeof(*r) + len);
+	w->nrec++;
+	w->frames++;
+
+	return 0;
+}
+
+/*
+ * idle check: write a partially filled block after XLCAP_FLUSH_MS
+ *
+ * returns the timeout in ms for the next check (-1: no pending frames)
+ * or -2 on write errors
+ */
+static inline int xlcap_idle(struct xlcap_writer *w)
+{
+	struct timespec now;
+	long age;
+
+	if (!w->nrec)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	age = (now.tv_sec - w->start.tv_sec) * 1000 +
+		(now.tv_nsec - w->start.tv_nsec) / 1000000;
+
+	if (age < XLCAP_FLUSH_MS)
+		return XLCAP_FLUSH_MS - age;
+
+	if (xlcap_flush(w) || fflush(w->f))
+		return -2;
+
+	return -1;
+}
+
+/* write the last block - returns 0 or -1 on write errors */
+static inline int xlcap_finish(struct xlcap_writer *w)
+{
+	int ret = xlcap_flush(w);
+
+	if (fflush(w->f))
+		ret = -1;
+
+	free(w->blk);
+	free(w->zbuf);
+	w->blk = w->zbuf = NULL;
+
+	return ret;
+}
+
+#endif /* XLCAP_H */
@@ -0,0 +1,456 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * xllog.h - asynchronous logging of CAN XL frames off the hot path
+ *
+ * Each writer (gateway thread) owns a lock-free single producer /
+ * single consumer ring of fixed size binary records. The writer only
+ * copies the CAN XL header and the first data bytes into the next free
+ * record. It never blocks and never enters the kernel: when the ring is
+ * full the record is dropped and counted as overrun.
+ *
+ * A separate formatter thread drains the rings of all writers and
+ * writes the records as text lines (printframe.h format) or as binary
+ * records. When all rings are empty it flushes the output and sleeps
+ * for XLLOG_IDLE_NS, so the writers never have to wake it up.
+ *
+ * The diagnostic messages of the gateways are logged as XLLOG_MSG
+ * records (message id and up to three arguments) through the same ring,
+ * so they are printed in sequence with the frames they refer to.
+ *
+ * Binary output: struct xllog_filehdr followed by struct xllog_rec
+ * records in host byte order. Overruns are reported in the stream with
+ * XLLOG_LOST records (number of lost records as __u64 in data[0..7]).
+ *
+ */
+
+#ifndef XLLOG_H
+#define XLLOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <linux/can.h>
+
+#include "printframe.h"
+
+#define XLLOG_CACHELINE 64
+#define XLLOG_SLOTS 4096 /* records per writer - power of 2 */
+#define XLLOG_DATA 16 /* logged data bytes (>= PRINTFRAME_XLDATA) */
+#define XLLOG_BUFSZ (1 << 16) /* formatter output buffer */
+#define XLLOG_IDLE_NS 1000000 /* formatter sleep when all rings are empty */
+
+#define XLLOG_MAGIC 0x474C4C58 /* 'XLLG' */
+#define XLLOG_VERSION 1
+
+/* record types */
+#define XLLOG_RX	0 /* received source frame */
+#define XLLOG_FW	1 /* forwarded unchanged */
+#define XLLOG_TX	2 /* sent fragment / reassembled PDU */
+#define XLLOG_BADVER	3 /* dropped due to wrong CiA 613-3 version */
+#define XLLOG_LOST	4 /* records lost due to ring overrun */
+#define XLLOG_MSG	5 /* diagnostic message (struct xllog_rec msg) */
+
+/* record flags - text layout of the gateways */
+#define XLLOG_F_START	0x01 /* empty line before the record (cia613frag rx) */
+#define XLLOG_F_END	0x02 /* empty line after the record (cia613join tx) */
+
+/* XLLOG_MSG message ids - CF/LF variants have consecutive ids */
+#define XLLOG_M_TIMEOUT		0
+#define XLLOG_M_LOWPRIO		1
+#define XLLOG_M_FF_SIZE		2
+#define XLLOG_M_CF_SIZE		3
+#define XLLOG_M_LF_SIZE		4
+#define XLLOG_M_FF_STEP		5
+#define XLLOG_M_CF_STEP		6
+#define XLLOG_M_LF_STEP		7
+#define XLLOG_M_FULL		8
+#define XLLOG_M_GRAB		9
+#define XLLOG_M_RESERVED	10
+#define XLLOG_M_CF_FCNT		11
+#define XLLOG_M_LF_FCNT		12
+#define XLLOG_M_CF_OVERFLOW	13
+#define XLLOG_M_LF_OVERFLOW	14
+#define XLLOG_M_TUNNEL		15
+#define XLLOG_M_MAX		16
+
+/* message formats with up to three unsigned int arguments */
+static const char *const xllog_msgfmt[XLLOG_M_MAX] = {
+	[XLLOG_M_TIMEOUT] = "TO: abort reception timeout! (TID %03X VCID %02X)\n",
+	[XLLOG_M_LOWPRIO] = "dropped high prio TID %03X (lowPrioCnt %d reaches M %d)\n",
+	[XLLOG_M_FF_SIZE] = "FF: dropped LLC frame illegal fragment size!\n",
+	[XLLOG_M_CF_SIZE] = "CF: dropped LLC frame illegal fragment size!\n",
+	[XLLOG_M_LF_SIZE] = "LF: dropped LLC frame illegal fragment size!\n",
+	[XLLOG_M_FF_STEP] = "FF: dropped LLC frame illegal fragment step size!\n",
+	[XLLOG_M_CF_STEP] = "CF: dropped LLC frame illegal fragment step size!\n",
+	[XLLOG_M_LF_STEP] = "LF: dropped LLC frame illegal fragment step size!\n",
+	[XLLOG_M_FULL] = "FF: dropped LLC frame (buffer full/low prio)!\n",
+	[XLLOG_M_GRAB] = "FF: grabbed buffer from TID %03X\n",
+	[XLLOG_M_RESERVED] = "FF/LF: dropped LLC frame with reserved FF/LF bits set!\n",
+	[XLLOG_M_CF_FCNT] = "CF: abort reception wrong FCNT! (%d/%d)\n",
+	[XLLOG_M_LF_FCNT] = "LF: abort reception wrong FCNT! (%d/%d)\n",
+	[XLLOG_M_CF_OVERFLOW] = "dropped CF frame size overflow!\n",
+	[XLLOG_M_LF_OVERFLOW] = "dropped LF frame size overflow!\n",
+	[XLLOG_M_TUNNEL] = "detected tunnel encapsulation -> frame dropped\n",
+};
+
+struct xllog_filehdr {
+	__u32 magic;
+	__u16 version;
+	__u16 recsize;
+};
+
+struct xllog_rec {
+	__u64 ts; /* ns since the epoch (rx timestamp for XLLOG_RX) */
+	__u8 type;
+	__u8 flags;
+	__u16 writer;
+
+	union {
+		struct {
+			/* CAN XL header in struct canxl_frame layout */
+			canid_t prio;
+			__u8 xlflags;
+			__u8 sdt;
+			__u16 len;
+			__u32 af;
+
+			__u8 data[XLLOG_DATA];
+		};
+
+		/* XLLOG_MSG */
+		struct {
+			__u32 id;
+			__u32 arg[3];
+		} msg;
+	};
+};
+
+struct xllog_ring {
+	/* writer side */
+	unsigned int head __attribute__((aligned(XLLOG_CACHELINE)));
+	unsigned int tail_cache;
+	unsigned long long lost;
+
+	/* formatter side */
+	unsigned int tail __attribute__((aligned(XLLOG_CACHELINE)));
+	unsigned long long lost_seen;
+
+	struct xllog_rec rec[XLLOG_SLOTS] __attribute__((aligned(XLLOG_CACHELINE)));
+};
+
+struct xllog {
+	pthread_t thread;
+	FILE *out;
+	int binary;
+	const char *ifname; /* source interface for the text output */
+	unsigned int nrings;
+	struct xllog_ring *ring;
+	int sync; /* no formatter thread - see xllog_sync() */
+	int stop;
+
+	/* formatter statistics */
+	unsigned long long written, lost;
+
+	unsigned int used;
+	char buf[XLLOG_BUFSZ];
+};
+
+static inline __u64 xllog_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline __u64 xllog_tv(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+/* next free record of the writer ring or NULL (counted) on overrun */
+static inline struct xllog_rec *xllog_rec(struct xllog_ring *r)
+{
+	if (r->head - r->tail_cache == XLLOG_SLOTS) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head - r->tail_cache == XLLOG_SLOTS) {
+			__atomic_store_n(&r->lost, r->lost + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+
+	return &r->rec[r->head & (XLLOG_SLOTS - 1)];
+}
+
+/* publish the record from xllog_rec() to the formatter */
+static inline void xllog_push(struct xllog_ring *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * log a diagnostic message in sequence with the frames of this ring
+ * or print it directly to stdout without a ring (no verbose output)
+ */
+static inline void xllog_msg(struct xllog_ring *r, unsigned int id,
+			     unsigned int a0, unsigned int a1, unsigned int a2)
+{
+	struct xllog_rec *rec;
+
+	if (!r) {
+		printf(xllog_msgfmt[id], a0, a1, a2);
+		return;
+	}
+
+	rec = xllog_rec(r);
+	if (!rec)
+		return;
+
+	rec->ts = xllog_now();
+	rec->type = XLLOG_MSG;
+	rec->flags = 0;
+	rec->msg.id = id;
+	rec->msg.arg[0] = a0;
+	rec->msg.arg[1] = a1;
+	rec->msg.arg[2] = a2;
+	xllog_push(r);
+}
+
+/* log the CAN XL header and the first XLLOG_DATA data bytes of cf */
+static inline void xllog_frame(struct xllog_ring *r, unsigned int type,
+			       unsigned int flags, __u64 ts,
+			       const struct canxl_frame *cf)
+{
+	struct xllog_rec *rec = xllog_rec(r);
+	unsigned int len = cf->len;
+
+	if (!rec)
+		return;
+
+	if (len > XLLOG_DATA)
+		len = XLLOG_DATA;
+
+	rec->ts = ts;
+	rec->type = type;
+	rec->flags = flags;
+	memcpy(&rec->prio, cf, CANXL_HDR_SIZE + len);
+	xllog_push(r);
+}
+
+static inline void xllog_out(struct xllog *log, const void *data,
+			     unsigned int len)
+{
+	if (log->used + len > XLLOG_BUFSZ) {
+		fwrite(log->buf, 1, log->used, log->out);
+		log->used = 0;
+	}
+
+	memcpy(&log->buf[log->used], data, len);
+	log->used += len;
+}
+
+static inline void xllog_text(struct xllog *log, const struct xllog_rec *rec)
+{
+	char line[PRINTFRAME_STRLEN + IFNAMSIZ + 64];
+	struct canxl_frame cf;
+	unsigned long long lost;
+	int n = 0;
+
+	if (rec->flags & XLLOG_F_START)
+		line[n++] = '\n';
+
+	switch (rec->type) {
+	case XLLOG_RX:
+		n += sprintf(&line[n], "(%llu.%06llu) %s ",
+			    (unsigned long long)rec->ts / 1000000000ULL,
+			    (unsigned long long)rec->ts % 1000000000ULL / 1000,
+			    log->ifname);
+		break;
+	case XLLOG_FW:
+		n += sprintf(&line[n], "FW - ");
+		break;
+	case XLLOG_TX:
+		n += sprintf(&line[n], "TX - ");
+		break;
+	case XLLOG_BADVER:
+		n += sprintf(&line[n], "Dropped frame due to wrong CiA 613-3 version\n");
+		break;
+	case XLLOG_LOST:
+		memcpy(&lost, rec->data, sizeof(lost));
+		n += sprintf(&line[n], "[writer %u: %llu log records lost]\n",
+			     rec->writer, lost);
+		break;
+	case XLLOG_MSG:
+		if (rec->msg.id < XLLOG_M_MAX)
+			n += sprintf(&line[n], xllog_msgfmt[rec->msg.id],
+				     rec->msg.arg[0], rec->msg.arg[1],
+				     rec->msg.arg[2]);
+		break;
+	}
+
+	if (rec->type <= XLLOG_TX) {
+		/* the data beyond XLLOG_DATA is not printed */
+		memcpy(&cf, &rec->prio, CANXL_HDR_SIZE + XLLOG_DATA);
+		n += sprintxlframe(&line[n], &cf);
+	}
+
+	if (rec->flags & XLLOG_F_END)
+		line[n++] = '\n';
+
+	xllog_out(log, line, n);
+}
+
+static inline void xllog_emit(struct xllog *log, const struct xllog_rec *rec)
+{
+	if (log->binary)
+		xllog_out(log, rec, sizeof(*rec));
+	else
+		xllog_text(log, rec);
+}
+
+/* drain all rings - returns the number of processed records */
+static inline unsigned int xllog_drain(struct xllog *log)
+{
+	struct xllog_ring *r;
+	struct xllog_rec lostrec = { .type = XLLOG_LOST };
+	unsigned long long lost;
+	unsigned int head, n = 0, i;
+
+	for (i = 0; i < log->nrings; i++) {
+		r = &log->ring[i];
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (; r->tail != head; r->tail++, n++) {
+			r->rec[r->tail & (XLLOG_SLOTS - 1)].writer = i;
+			xllog_emit(log, &r->rec[r->tail & (XLLOG_SLOTS - 1)]);
+		}
+		__atomic_store_n(&r->tail, r->tail, __ATOMIC_RELEASE);
+
+		/* mark the gap in the output stream */
+		lost = __atomic_load_n(&r->lost, __ATOMIC_RELAXED);
+		if (lost != r->lost_seen) {
+			lostrec.ts = xllog_now();
+			lostrec.writer = i;
+			lost -= r->lost_seen;
+			memcpy(lostrec.data, &lost, sizeof(lost));
+			xllog_emit(log, &lostrec);
+			r->lost_seen += lost;
+			log->lost += lost;
+		}
+	}
+	log->written += n;
+
+	return n;
+}
+
+static inline void xllog_write(struct xllog *log)
+{
+	if (log->used) {
+		fwrite(log->buf, 1, log->used, log->out);
+		log->used = 0;
+	}
+}
+
+static inline void xllog_flush(struct xllog *log)
+{
+	xllog_write(log);
+	fflush(log->out);
+}
+
+/*
+ * synchronous mode: format the pending records in the (single) writer
+ * thread, e.g. before the writer prints to the same output itself
+ */
+static inline void xllog_sync(struct xllog *log)
+{
+	xllog_drain(log);
+	xllog_write(log);
+}
+
+static inline void *xllog_thread(void *arg)
+{
+	struct xllog *log = arg;
+	struct timespec idle = { .tv_nsec = XLLOG_IDLE_NS };
+
+	while (!__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE)) {
+		if (xllog_drain(log))
+			continue;
+
+		xllog_flush(log);
+		nanosleep(&idle, NULL);
+	}
+
+	/* the writers have finished */
+	xllog_drain(log);
+	xllog_flush(log);
+
+	return NULL;
+}
+
+/*
+ * allocate nrings writer rings and start the formatter thread
+ * (should be called with SIGINT/SIGTERM blocked) - with sync the
+ * single writer formats its records itself with xllog_sync()
+ *
+ * returns 0 on success or a negative error code
+ */
+static inline int xllog_start(struct xllog *log, unsigned int nrings,
+			      FILE *out, int binary, const char *ifname,
+			      int sync)
+{
+	struct xllog_filehdr fh = {
+		.magic = XLLOG_MAGIC,
+		.version = XLLOG_VERSION,
+		.recsize = sizeof(struct xllog_rec),
+	};
+
+	log->ring = aligned_alloc(XLLOG_CACHELINE,
+				  nrings * sizeof(struct xllog_ring));
+	if (!log->ring)
+		return -ENOMEM;
+
+	memset(log->ring, 0, nrings * sizeof(struct xllog_ring));
+	log->nrings = nrings;
+	log->out = out;
+	log->binary = binary;
+	log->ifname = ifname;
+	log->sync = sync;
+	log->stop = 0;
+	log->written = 0;
+	log->lost = 0;
+	log->used = 0;
+
+	if (binary)
+		xllog_out(log, &fh, sizeof(fh));
+
+	if (sync)
+		return 0;
+
+	if (pthread_create(&log->thread, NULL, xllog_thread, log)) {
+		free(log->ring);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* write the remaining records after all writers have finished */
+static inline void xllog_stop(struct xllog *log)
+{
+	if (log->sync) {
+		xllog_drain(log);
+		xllog_flush(log);
+	} else {
+		__atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(log->thread, NULL);
+	}
+
+	free(log->ring);
+	log->ring = NULL;
+}
+
+#endif /* XLLOG_H */
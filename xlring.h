@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * xlring.h - lock-free single producer / single consumer ring of
+ *            preallocated CAN XL frame slots
+ *
+ * The producer fills the slot from xlring_prod_slot() in place and
+ * publishes it with xlring_push(). The consumer processes the slot from
+ * xlring_cons_slot() in place and releases it with xlring_pop().
+ *
+ * Producer and consumer indices are placed in separate cache lines and
+ * each side caches the index of the other side to touch the shared
+ * cache line only when the ring seems to be full/empty. A waiting side
+ * sleeps on a futex which is only woken up when the other side has
+ * announced that it waits.
+ *
+ */
+
+#ifndef XLRING_H
+#define XLRING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+#include <linux/can.h>
+
+#define XLRING_CACHELINE 64
+#define XLRING_SPIN 128 /* polls before sleeping on the futex */
+#define XLRING_WAIT_NS 100000000 /* max futex sleep to check for exit */
+
+struct xlring_slot {
+	struct canxl_frame cf;
+	struct timeval tv; /* rx timestamp (optional) */
+} __attribute__((aligned(XLRING_CACHELINE)));
+
+struct xlring {
+	/* producer side */
+	unsigned int head __attribute__((aligned(XLRING_CACHELINE)));
+	unsigned int tail_cache;
+	unsigned int prod_waiting;
+	unsigned int hwm; /* max. number of used slots */
+	unsigned long long stalls; /* producer found the ring full */
+
+	/* consumer side */
+	unsigned int tail __attribute__((aligned(XLRING_CACHELINE)));
+	unsigned int head_cache;
+	unsigned int cons_waiting;
+
+	/* read-only after xlring_init() */
+	unsigned int size __attribute__((aligned(XLRING_CACHELINE)));
+	unsigned int mask;
+	struct xlring_slot *slot;
+};
+
+/* size must be a power of 2 - returns 0 on success or -ENOMEM */
+static inline int xlring_init(struct xlring *r, unsigned int size)
+{
+	memset(r, 0, sizeof(*r));
+
+	r->slot = aligned_alloc(XLRING_CACHELINE,
+				size * sizeof(struct xlring_slot));
+	if (!r->slot)
+		return -ENOMEM;
+
+	r->size = size;
+	r->mask = size - 1;
+
+	return 0;
+}
+
+static inline void xlring_free(struct xlring *r)
+{
+	free(r->slot);
+	r->slot = NULL;
+}
+
+static inline void xlring_futex_wait(unsigned int *addr, unsigned int val)
+{
+	struct timespec ts = { .tv_nsec = XLRING_WAIT_NS };
+
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static inline void xlring_futex_wake(unsigned int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* free slot to be filled by the producer or NULL when the ring is full */
+static inline struct xlring_slot *xlring_prod_slot(struct xlring *r)
+{
+	if (r->head - r->tail_cache == r->size) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head - r->tail_cache == r->size)
+			return NULL;
+	}
+
+	return &r->slot[r->head & r->mask];
+}
+
+/* publish the slot from xlring_prod_slot() to the consumer */
+static inline void xlring_push(struct xlring *r)
+{
+	unsigned int used;
+
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&r->cons_waiting, __ATOMIC_SEQ_CST))
+		xlring_futex_wake(&r->head);
+
+	/* the cached tail may be outdated => only reload for a new hwm */
+	used = r->head - r->tail_cache;
+	if (used > r->hwm) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		used = r->head - r->tail_cache;
+		if (used > r->hwm)
+			r->hwm = used;
+	}
+}
+
+/* next slot to be processed by the consumer or NULL when the ring is empty */
+static inline struct xlring_slot *xlring_cons_slot(struct xlring *r)
+{
+	if (r->tail == r->head_cache) {
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (r->tail == r->head_cache)
+			return NULL;
+	}
+
+	return &r->slot[r->tail & r->mask];
+}
+
+/* release the slot from xlring_cons_slot() to the producer */
+static inline void xlring_pop(struct xlring *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&r->prod_waiting, __ATOMIC_SEQ_CST))
+		xlring_futex_wake(&r->tail);
+}
+
+/* wait for a free slot - returns NULL when *running becomes zero */
+static inline struct xlring_slot *xlring_prod_wait(struct xlring *r,
+						   volatile int *running)
+{
+	struct xlring_slot *s;
+	unsigned int tail;
+	int spin;
+
+	s = xlring_prod_slot(r);
+	if (s)
+		return s;
+
+	r->stalls++;
+
+	while (*running) {
+		for (spin = 0; spin < XLRING_SPIN; spin++) {
+			s = xlring_prod_slot(r);
+			if (s)
+				return s;
+		}
+
+		__atomic_store_n(&r->prod_waiting, 1, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+		if (r->head - tail == r->size)
+			xlring_futex_wait(&r->tail, tail);
+		__atomic_store_n(&r->prod_waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/* wait for a filled slot - returns NULL when *running becomes zero */
+static inline struct xlring_slot *xlring_cons_wait(struct xlring *r,
+						   volatile int *running)
+{
+	struct xlring_slot *s;
+	unsigned int head;
+	int spin;
+
+	while (*running) {
+		for (spin = 0; spin < XLRING_SPIN; spin++) {
+			s = xlring_cons_slot(r);
+			if (s)
+				return s;
+		}
+
+		__atomic_store_n(&r->cons_waiting, 1, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+		if (r->tail == head)
+			xlring_futex_wait(&r->head, head);
+		__atomic_store_n(&r->cons_waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+#endif /* XLRING_H */
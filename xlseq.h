@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * xlseq.h - sequence number and TX timestamp payload header
+ *
+ * canxlgen -Q puts this header in front of the data pattern and
+ * canxlrcv -Q uses it to detect lost, duplicated and reordered frames
+ * and to measure the one-way latency (also across the frag/join
+ * gateways as the reassembled PDU contains the original payload).
+ *
+ * Layout (big endian):
+ *
+ *   0 .. 1   magic 0x5351 ('SQ')
+ *   2 .. 3   stream ID
+ *   4 .. 11  sequence number
+ *  12 .. 19  CLOCK_MONOTONIC TX timestamp in ns
+ *
+ * The data pattern (dlen + i) & 0xFF continues at offset XLSEQ_SIZE.
+ * The TX timestamp is only comparable on the same host.
+ */
+
+#ifndef XLSEQ_H
+#define XLSEQ_H
+
+#include <time.h>
+#include <linux/types.h>
+
+#define XLSEQ_MAGIC 0x5351
+#define XLSEQ_SIZE 20
+
+static inline __u64 xlseq_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void xlseq_put_be(__u8 *p, __u64 val, unsigned int n)
+{
+	while (n--) {
+		p[n] = val & 0xFF;
+		val >>= 8;
+	}
+}
+
+static inline __u64 xlseq_get_be(const __u8 *p, unsigned int n)
+{
+	__u64 val = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		val = (val << 8) | p[i];
+
+	return val;
+}
+
+static inline void xlseq_put(__u8 *data, __u16 stream, __u64 seq, __u64 ts)
+{
+	xlseq_put_be(&data[0], XLSEQ_MAGIC, 2);
+	xlseq_put_be(&data[2], stream, 2);
+	xlseq_put_be(&data[4], seq, 8);
+	xlseq_put_be(&data[12], ts, 8);
+}
+
+/* returns 0 on success or -1 when there is no sequence header */
+static inline int xlseq_get(const __u8 *data, unsigned int len,
+			    __u16 *stream, __u64 *seq, __u64 *ts)
+{
+	if (len < XLSEQ_SIZE || xlseq_get_be(&data[0], 2) != XLSEQ_MAGIC)
+		return -1;
+
+	*stream = xlseq_get_be(&data[2], 2);
+	*seq = xlseq_get_be(&data[4], 8);
+	*ts = xlseq_get_be(&data[12], 8);
+
+	return 0;
+}
+
+#endif /* XLSEQ_H */